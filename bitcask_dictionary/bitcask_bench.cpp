@@ -0,0 +1,712 @@
+// Benchmarks for bitcask_dictionary: generates a synthetic dictionary and query stream, then times
+// the build, cold and warm single lookups, a full read and a merge through the engine's own code.
+// Every result is one JSON line on stdout; progress and engine logs go to stderr.
+//
+// Build with "make bench". The engine is compiled into this binary, so it is measured with the
+// optimization flags used here rather than those of the command line tool.
+#define BITCASK_NO_MAIN
+#include "bitcask_dictionary.cpp"
+
+#include <random>
+
+// Stateless 64-bit mixer (the SplitMix64 finalizer), so key i is the same whatever order keys are made in
+uint64_t Mix(uint64_t x)
+{
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+// Uniform double in [0, 1) from the top 53 bits of a hash
+double UnitInterval(uint64_t hash)
+{
+    return static_cast<double>(hash >> 11) * (1.0 / 9007199254740992.0);
+}
+
+// Length distribution given as fixed:<n>, uniform:<min>:<max> or normal:<mean>:<stddev>
+class LengthDistribution
+{
+public:
+    bool Parse(const std::string &value)
+    {
+        spec = value;
+        std::vector<std::string> parts;
+        std::stringstream stream(value);
+        for (std::string part; std::getline(stream, part, ':');)
+            parts.push_back(part);
+        try
+        {
+            if (parts.size() == 2 && parts[0] == "fixed")
+            {
+                kind = Kind::Fixed;
+                a = std::stod(parts[1]);
+            }
+            else if (parts.size() == 3 && (parts[0] == "uniform" || parts[0] == "normal"))
+            {
+                kind = parts[0] == "uniform" ? Kind::Uniform : Kind::Normal;
+                a = std::stod(parts[1]);
+                b = std::stod(parts[2]);
+            }
+            else
+                return false;
+        }
+        catch (const std::exception &)
+        {
+            return false;
+        }
+        return a >= 1 && (kind != Kind::Uniform || b >= a) && b >= 0;
+    }
+
+    size_t Sample(uint64_t hash) const
+    {
+        double length = a;
+        if (kind == Kind::Uniform)
+            length = a + std::floor(UnitInterval(hash) * (b - a + 1));
+        else if (kind == Kind::Normal)
+        {
+            // Box-Muller on two halves of the hash stream
+            double u1 = std::max(UnitInterval(hash), 1e-12), u2 = UnitInterval(Mix(hash));
+            length = std::round(a + b * std::sqrt(-2 * std::log(u1)) * std::cos(2 * M_PI * u2));
+        }
+        return static_cast<size_t>(std::max(length, 1.0));
+    }
+
+    const std::string &Spec() const { return spec; }
+
+private:
+    enum class Kind
+    {
+        Fixed,
+        Uniform,
+        Normal
+    };
+
+    Kind kind = Kind::Fixed;
+    double a = 1, b = 0;
+    std::string spec;
+};
+
+// Keys and meanings as pure functions of their index. Indices below keyCount are in the
+// dictionary; indices from keyCount to 2 * keyCount are misses drawn from the same distribution.
+// A key is random letters followed by its index in fixed-width base 26, so keys are unique and
+// their sort order has nothing to do with their index.
+class DictionaryGenerator
+{
+public:
+    DictionaryGenerator(uint64_t keyCount, const LengthDistribution &keyLength, const LengthDistribution &meaningLength, uint64_t seed)
+        : keyCount(keyCount), keyLength(keyLength), meaningLength(meaningLength), seed(seed)
+    {
+        for (uint64_t capacity = 1; capacity < 2 * keyCount; capacity *= 26)
+            suffixWidth++;
+    }
+
+    void Key(uint64_t index, std::string &key) const
+    {
+        uint64_t hash = Mix(seed ^ Mix(index));
+        size_t length = std::max(keyLength.Sample(hash), suffixWidth);
+        key.clear();
+        for (size_t i = suffixWidth; i < length; ++i)
+        {
+            hash = Mix(hash);
+            key += static_cast<char>('a' + hash % 26);
+        }
+        for (size_t i = 0; i < suffixWidth; ++i)
+            key += static_cast<char>('a' + (index / Power26(suffixWidth - 1 - i)) % 26);
+    }
+
+    // Lowercase words and spaces; revision gives an updated key a different meaning
+    void Meaning(uint64_t index, uint64_t revision, std::string &meaning) const
+    {
+        uint64_t hash = Mix(~seed ^ Mix(index) ^ Mix(revision));
+        size_t length = meaningLength.Sample(hash);
+        meaning.clear();
+        while (meaning.size() < length)
+        {
+            hash = Mix(hash);
+            for (int i = 0; i < 8 && meaning.size() < length; ++i)
+            {
+                unsigned letter = (hash >> (8 * i)) % 32;
+                meaning += (letter >= 26 && !meaning.empty() && meaning.back() != ' ') ? ' ' : static_cast<char>('a' + letter % 26);
+            }
+        }
+    }
+
+    // Write every stride-th key as a CSV row; returns the bytes written
+    uint64_t WriteCsv(const std::string &path, uint64_t stride, uint64_t revision) const
+    {
+        std::ofstream out(path, std::ios::binary);
+        std::string buffer, key, meaning;
+        uint64_t written = 0;
+        for (uint64_t index = 0; index < keyCount && out; index += stride)
+        {
+            Key(index, key);
+            Meaning(index, revision, meaning);
+            buffer += key;
+            buffer += ',';
+            buffer += meaning;
+            buffer += '\n';
+            if (buffer.size() >= 1024 * 1024)
+            {
+                out.write(buffer.data(), buffer.size());
+                written += buffer.size();
+                buffer.clear();
+            }
+        }
+        out.write(buffer.data(), buffer.size());
+        written += buffer.size();
+        return out ? written : 0;
+    }
+
+    uint64_t KeyCount() const { return keyCount; }
+
+private:
+    static uint64_t Power26(size_t exponent)
+    {
+        uint64_t value = 1;
+        while (exponent--)
+            value *= 26;
+        return value;
+    }
+
+    uint64_t keyCount;
+    LengthDistribution keyLength;
+    LengthDistribution meaningLength;
+    uint64_t seed;
+    size_t suffixWidth = 1;
+};
+
+// Zipf ranks in [1, n] by rejection-inversion (Hoermann and Derflinger), in constant time and
+// memory however many keys there are
+class ZipfSampler
+{
+public:
+    ZipfSampler(uint64_t n, double exponent) : n(static_cast<double>(n)), s(exponent)
+    {
+        hIntegralX1 = HIntegral(1.5) - 1.0;
+        hIntegralN = HIntegral(this->n + 0.5);
+        squeeze = 2.0 - HIntegralInverse(HIntegral(2.5) - H(2.0));
+    }
+
+    template <typename Random>
+    uint64_t Sample(Random &random) const
+    {
+        std::uniform_real_distribution<double> unit(0.0, 1.0);
+        for (;;)
+        {
+            double u = hIntegralN + unit(random) * (hIntegralX1 - hIntegralN);
+            double x = HIntegralInverse(u);
+            double k = std::min(std::max(std::floor(x + 0.5), 1.0), n);
+            if (k - x <= squeeze || u >= HIntegral(k + 0.5) - H(k))
+                return static_cast<uint64_t>(k);
+        }
+    }
+
+private:
+    double H(double x) const { return std::exp(-s * std::log(x)); }
+
+    double HIntegral(double x) const
+    {
+        double logX = std::log(x);
+        return Helper2((1.0 - s) * logX) * logX;
+    }
+
+    double HIntegralInverse(double x) const
+    {
+        double t = std::max(x * (1.0 - s), -1.0);
+        return std::exp(Helper1(t) * x);
+    }
+
+    // log1p(x) / x and expm1(x) / x, with their limits near zero
+    static double Helper1(double x) { return std::abs(x) > 1e-8 ? std::log1p(x) / x : 1.0 - x * (0.5 - x * (1.0 / 3.0 - 0.25 * x)); }
+    static double Helper2(double x) { return std::abs(x) > 1e-8 ? std::expm1(x) / x : 1.0 + x * 0.5 * (1.0 + x * (1.0 / 3.0) * (1.0 + 0.25 * x)); }
+
+    double n, s;
+    double hIntegralX1, hIntegralN, squeeze;
+};
+
+struct BenchConfig
+{
+    uint64_t keys = 100000;
+    uint64_t queries = 100000;
+    uint64_t coldSamples = 50;
+    uint64_t seed = 1;
+    double missRatio = 0.1;
+    double zipfExponent = 0.99; // 0 for uniform queries
+    std::string queryDistribution = "zipf:0.99";
+    LengthDistribution keyLength;
+    LengthDistribution meaningLength;
+    unsigned threads = 1;
+    std::string dir = "bench_data";
+};
+
+// Key indices of the query stream: misses with the configured ratio, hits zipfian over key rank
+// or uniform over the keys
+std::vector<uint64_t> MakeQueries(const BenchConfig &config)
+{
+    std::mt19937_64 random(config.seed);
+    std::uniform_real_distribution<double> unit(0.0, 1.0);
+    std::uniform_int_distribution<uint64_t> anyKey(0, config.keys - 1);
+    std::unique_ptr<ZipfSampler> zipf;
+    if (config.zipfExponent > 0)
+        zipf = std::make_unique<ZipfSampler>(config.keys, config.zipfExponent);
+
+    std::vector<uint64_t> queries(config.queries);
+    for (auto &query : queries)
+    {
+        if (unit(random) < config.missRatio)
+            query = config.keys + anyKey(random);
+        else
+            query = zipf ? zipf->Sample(random) - 1 : anyKey(random);
+    }
+    return queries;
+}
+
+// One benchmark result as a JSON object on a line of its own
+class ResultLine
+{
+public:
+    ResultLine(const std::string &benchmark, const BenchConfig &config)
+    {
+        out << std::fixed << std::setprecision(6) << "{\"benchmark\":\"" << benchmark << '"';
+        Add("keys", config.keys);
+        Add("key_length", config.keyLength.Spec());
+        Add("meaning_length", config.meaningLength.Spec());
+        Add("compress", compressData);
+        Add("perfect_hash", buildPerfectHash);
+    }
+
+    ResultLine &Add(const char *name, const std::string &value)
+    {
+        out << ",\"" << name << "\":\"" << value << '"';
+        return *this;
+    }
+    ResultLine &Add(const char *name, const char *value) { return Add(name, std::string(value)); }
+    ResultLine &Add(const char *name, bool value)
+    {
+        out << ",\"" << name << "\":" << (value ? "true" : "false");
+        return *this;
+    }
+    template <typename Number>
+    ResultLine &Add(const char *name, Number value)
+    {
+        out << ",\"" << name << "\":" << value;
+        return *this;
+    }
+
+    // Operations and bytes per second over the elapsed time
+    ResultLine &Throughput(uint64_t operations, uint64_t bytes, double seconds)
+    {
+        Add("operations", operations);
+        Add("bytes", bytes);
+        Add("seconds", seconds);
+        Add("ops_per_second", seconds > 0 ? operations / seconds : 0.0);
+        Add("mb_per_second", seconds > 0 ? bytes / seconds / (1024 * 1024) : 0.0);
+        return *this;
+    }
+
+    ResultLine &Latencies(const LatencyHistogram &h)
+    {
+        out << ",\"latency_ns\":{\"count\":" << h.Count() << ",\"mean\":" << h.Mean() << ",\"p50\":" << h.Percentile(0.5)
+            << ",\"p90\":" << h.Percentile(0.9) << ",\"p99\":" << h.Percentile(0.99) << ",\"p999\":" << h.Percentile(0.999)
+            << ",\"max\":" << h.Max() << "}";
+        return *this;
+    }
+
+    void Write() { std::cout << out.str() << "}" << std::endl; }
+
+private:
+    std::ostringstream out;
+};
+
+double SecondsSince(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+uint64_t FileSize(const std::string &path)
+{
+    std::error_code error;
+    uint64_t size = std::filesystem::file_size(path, error);
+    return error ? 0 : size;
+}
+
+// Bytes of a dictionary's files, over every shard of a sharded one
+uint64_t DictionarySize(const std::string &path)
+{
+    uint64_t size = 0;
+    for (const auto &file : DictionaryShardFiles(path))
+        size += FileSize(file);
+    return size;
+}
+
+// Write back and drop the file's cached pages so the next read comes from the device. Pages
+// still mapped by another process stay, so cold numbers are a best effort.
+void DropFromPageCache(const std::string &path)
+{
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return;
+    fdatasync(fd);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd);
+}
+
+void LoadIntoPageCache(const std::string &path)
+{
+    std::ifstream in(path, std::ios::binary);
+    std::vector<char> buffer(1024 * 1024);
+    while (in.read(buffer.data(), buffer.size()) || in.gcount() > 0)
+    {
+    }
+}
+
+Dictionary::Options LookupOptions(bool loadIndex)
+{
+    Dictionary::Options options;
+    options.readMode = ReadBackend(IoBackend::Pread);
+    options.loadIndex = loadIndex;
+    options.verifyChecksums = verifyReads;
+    return options;
+}
+
+void BenchBuild(const BenchConfig &config, const std::string &csvPath, const std::string &dictionaryPath)
+{
+    auto start = std::chrono::steady_clock::now();
+    CreateDictionary(csvPath, dictionaryPath, config.threads);
+    double seconds = SecondsSince(start);
+    ResultLine("build", config)
+        .Add("threads", config.threads)
+        .Add("shards", dictionaryShards)
+        .Throughput(config.keys, FileSize(csvPath), seconds)
+        .Add("dictionary_bytes", DictionarySize(dictionaryPath))
+        .Write();
+}
+
+// What --search costs with nothing cached: open the dictionary and look up one word
+void BenchColdLookups(const BenchConfig &config, const std::vector<std::string> &queries, const std::string &dictionaryPath, bool loadIndex)
+{
+    LatencyHistogram latency;
+    uint64_t samples = std::min<uint64_t>(config.coldSamples, queries.size()), hits = 0, bytes = 0;
+    double seconds = 0;
+    std::string meaning;
+    for (uint64_t i = 0; i < samples; ++i)
+    {
+        DropFromPageCache(dictionaryPath);
+        for (const auto &file : DictionaryShardFiles(dictionaryPath))
+        {
+            DropFromPageCache(file);
+            DropFromPageCache(HintPathFor(file));
+        }
+        auto start = std::chrono::steady_clock::now();
+        auto dictionary = Dictionary::Open(dictionaryPath, LookupOptions(loadIndex));
+        if (dictionary && dictionary->Get(queries[i], meaning))
+        {
+            hits++;
+            bytes += meaning.size();
+        }
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        latency.Record(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+        seconds += std::chrono::duration<double>(elapsed).count();
+    }
+    ResultLine("lookup_cold", config)
+        .Add("fast_read", loadIndex)
+        .Add("io", IoBackendName(ReadBackend(IoBackend::Pread)))
+        .Add("query_distribution", config.queryDistribution)
+        .Add("miss_ratio", config.missRatio)
+        .Add("hits", hits)
+        .Throughput(samples, bytes, seconds)
+        .Latencies(latency)
+        .Write();
+}
+
+// Lookups through one open dictionary with its files in the page cache
+void BenchWarmLookups(const BenchConfig &config, const std::vector<std::string> &queries, const std::string &dictionaryPath, bool loadIndex)
+{
+    for (const auto &file : DictionaryShardFiles(dictionaryPath))
+    {
+        LoadIntoPageCache(file);
+        LoadIntoPageCache(HintPathFor(file));
+    }
+    auto openStart = std::chrono::steady_clock::now();
+    auto dictionary = Dictionary::Open(dictionaryPath, LookupOptions(loadIndex));
+    double openSeconds = SecondsSince(openStart);
+    if (!dictionary)
+    {
+        BITCASK_LOG(Error, "Failed to open " << dictionaryPath);
+        return;
+    }
+
+    LatencyHistogram latency;
+    uint64_t hits = 0, bytes = 0;
+    std::string meaning;
+    auto start = std::chrono::steady_clock::now();
+    for (const auto &query : queries)
+    {
+        auto lookupStart = std::chrono::steady_clock::now();
+        bool found = dictionary->Get(query, meaning);
+        latency.Record(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - lookupStart).count());
+        if (found)
+        {
+            hits++;
+            bytes += meaning.size();
+        }
+    }
+    double seconds = SecondsSince(start);
+    ResultLine("lookup_warm", config)
+        .Add("fast_read", loadIndex)
+        .Add("io", IoBackendName(ReadBackend(IoBackend::Pread)))
+        .Add("query_distribution", config.queryDistribution)
+        .Add("miss_ratio", config.missRatio)
+        .Add("hits", hits)
+        .Add("open_seconds", openSeconds)
+        .Throughput(queries.size(), bytes, seconds)
+        .Latencies(latency)
+        .Write();
+}
+
+// --search-batch over the query stream with cold files and its output discarded; this is where
+// --io uring keeps many reads in flight
+void BenchBatchLookups(const BenchConfig &config, const std::string &queriesPath, const std::string &dictionaryPath, bool loadIndex)
+{
+    for (const auto &file : DictionaryShardFiles(dictionaryPath))
+    {
+        DropFromPageCache(file);
+        DropFromPageCache(HintPathFor(file));
+    }
+    std::ofstream discard("/dev/null");
+    std::streambuf *stdoutBuffer = std::cout.rdbuf(discard.rdbuf());
+    bool savedFastRead = fastRead;
+    fastRead = loadIndex;
+    auto start = std::chrono::steady_clock::now();
+    SearchBatch(queriesPath, dictionaryPath);
+    std::cout.flush();
+    double seconds = SecondsSince(start);
+    fastRead = savedFastRead;
+    std::cout.rdbuf(stdoutBuffer);
+
+    ResultLine("lookup_batch", config)
+        .Add("fast_read", loadIndex)
+        .Add("io", IoBackendName(ReadBackend(IoBackend::Pread)))
+        .Add("query_distribution", config.queryDistribution)
+        .Add("miss_ratio", config.missRatio)
+        .Throughput(config.queries, FileSize(queriesPath), seconds)
+        .Write();
+}
+
+// --read-dict with its output discarded, so the time is the engine's plus formatting
+void BenchRead(const BenchConfig &config, const std::string &dictionaryPath, bool loadIndex)
+{
+    std::ofstream discard("/dev/null");
+    std::streambuf *stdoutBuffer = std::cout.rdbuf(discard.rdbuf());
+    bool savedFastRead = fastRead;
+    fastRead = loadIndex;
+    auto start = std::chrono::steady_clock::now();
+    // Shards of a sharded dictionary load their own indexes
+    if (loadIndex && dictionaryShards <= 1)
+    {
+        inMemoryIndex.clear();
+        LoadIndex(dictionaryPath);
+    }
+    ReadDictionary(dictionaryPath, config.threads);
+    std::cout.flush();
+    double seconds = SecondsSince(start);
+    inMemoryIndex.clear();
+    fastRead = savedFastRead;
+    std::cout.rdbuf(stdoutBuffer);
+
+    ResultLine("read", config)
+        .Add("fast_read", loadIndex)
+        .Throughput(config.keys, DictionarySize(dictionaryPath), seconds)
+        .Write();
+}
+
+// --export-csv to /dev/null: the scan engine reading the data section in file order
+void BenchExport(const BenchConfig &config, const std::string &dictionaryPath)
+{
+    auto start = std::chrono::steady_clock::now();
+    ExportCsv(dictionaryPath, "/dev/null", config.threads);
+    double seconds = SecondsSince(start);
+    ResultLine("export", config)
+        .Add("threads", config.threads)
+        .Throughput(config.keys, DictionarySize(dictionaryPath), seconds)
+        .Write();
+}
+
+// Merge the dictionary with an update of every tenth key, which --merge-dict copies through
+void BenchMerge(const BenchConfig &config, const DictionaryGenerator &generator, const std::string &dictionaryPath)
+{
+    std::string updatesCsv = config.dir + "/updates.csv", updatesPath = config.dir + "/updates.bitcask", mergedPath = config.dir + "/merged.bitcask";
+    generator.WriteCsv(updatesCsv, 10, 1);
+    CreateDictionary(updatesCsv, updatesPath, config.threads);
+
+    uint64_t inputRecords = config.keys + (config.keys + 9) / 10;
+    uint64_t inputBytes = DictionarySize(dictionaryPath) + DictionarySize(updatesPath);
+    auto start = std::chrono::steady_clock::now();
+    MergeDictionary({dictionaryPath, updatesPath}, mergedPath, config.threads);
+    double seconds = SecondsSince(start);
+    ResultLine("merge", config)
+        .Throughput(inputRecords, inputBytes, seconds)
+        .Add("merged_bytes", DictionarySize(mergedPath))
+        .Write();
+}
+
+int main(int argc, char *argv[])
+{
+    std::ios::sync_with_stdio(false);
+
+    std::vector<std::string> args(argv + 1, argv + argc);
+    auto extractFlag = [&args](const std::string &flag) -> bool {
+        auto it = std::find(args.begin(), args.end(), flag);
+        if (it == args.end())
+            return false;
+        args.erase(it);
+        return true;
+    };
+    auto extractOption = [&args](const std::string &option, const std::string &defaultValue) -> std::string {
+        auto it = std::find(args.begin(), args.end(), option);
+        if (it == args.end() || std::next(it) == args.end())
+            return defaultValue;
+        std::string value = *std::next(it);
+        args.erase(it, std::next(it, 2));
+        return value;
+    };
+
+    BenchConfig config;
+    bool generateOnly = extractFlag("--generate-only");
+    bool keep = extractFlag("--keep");
+    if (extractFlag("--mmap"))
+        ioBackend = IoBackend::Mmap;
+    compressData = extractFlag("--compress");
+    buildPerfectHash = extractFlag("--perfect-hash");
+    std::string keyLengthOption = extractOption("--key-length", "uniform:4:16");
+    std::string meaningLengthOption = extractOption("--meaning-length", "normal:60:20");
+    std::string distributionOption = extractOption("--query-dist", "zipf:0.99");
+    std::string benchOption = extractOption("--bench", "build,lookup,read,merge");
+    std::string logLevelOption = extractOption("--log-level", "warn");
+    std::string sortMemoryOption = extractOption("--sort-memory", "1024");
+    std::string shardsOption = extractOption("--shards", "0");
+    std::string ioOption = extractOption("--io", "");
+    IoBackend selectedBackend;
+    if (ParseIoBackend(ioOption, selectedBackend))
+        ioBackend = selectedBackend;
+    else if (!ioOption.empty())
+        args.push_back("invalid backend");
+    config.dir = extractOption("--dir", config.dir);
+    try
+    {
+        config.keys = std::stoull(extractOption("--keys", std::to_string(config.keys)));
+        config.queries = std::stoull(extractOption("--queries", std::to_string(config.queries)));
+        config.coldSamples = std::stoull(extractOption("--cold-samples", std::to_string(config.coldSamples)));
+        config.seed = std::stoull(extractOption("--seed", std::to_string(config.seed)));
+        config.missRatio = std::stod(extractOption("--miss-ratio", "0.1"));
+        config.threads = static_cast<unsigned>(std::max(1, std::stoi(extractOption("--threads", std::to_string(std::max(1u, std::thread::hardware_concurrency()))))));
+        sortMemoryBudget = static_cast<size_t>(std::stoull(sortMemoryOption)) * 1024 * 1024;
+        dictionaryShards = static_cast<uint32_t>(std::min<unsigned long long>(std::stoull(shardsOption), kMaxShards + 1ull));
+    }
+    catch (const std::exception &)
+    {
+        args.push_back("invalid number");
+    }
+
+    config.queryDistribution = distributionOption;
+    bool validDistribution = distributionOption == "uniform";
+    if (validDistribution)
+        config.zipfExponent = 0;
+    else if (distributionOption.rfind("zipf:", 0) == 0)
+    {
+        config.zipfExponent = std::atof(distributionOption.c_str() + 5);
+        validDistribution = config.zipfExponent > 0;
+    }
+
+    if (!args.empty() || config.keys == 0 || config.missRatio < 0 || config.missRatio > 1 || !validDistribution || dictionaryShards > kMaxShards ||
+        !config.keyLength.Parse(keyLengthOption) || !config.meaningLength.Parse(meaningLengthOption) || !ParseLogLevel(logLevelOption, logLevel))
+    {
+        std::cerr << "Usage: " << argv[0] << " [--keys <n>] [--key-length <dist>] [--meaning-length <dist>] [--queries <n>] [--query-dist zipf:<s>|uniform] [--miss-ratio <r>] [--seed <n>] [--bench build,lookup,read,merge] [--cold-samples <n>] [--threads <n>] [--sort-memory <MB>] [--shards <n>] [--compress] [--perfect-hash] [--io stream|pread|mmap|uring] [--mmap] [--dir <path>] [--keep] [--generate-only] [--log-level error|warn|info|debug|trace]\n"
+                  << "  <dist> is fixed:<n>, uniform:<min>:<max> or normal:<mean>:<stddev>\n";
+        return 1;
+    }
+    auto runs = [&benchOption](const std::string &name) { return ("," + benchOption + ",").find("," + name + ",") != std::string::npos; };
+
+    // Merges record the new version in a config file; keep it with the generated data
+    std::filesystem::create_directories(config.dir);
+    configPath = config.dir + "/dictionary.config";
+    version = "1";
+    std::string csvPath = config.dir + "/words.csv", queriesPath = config.dir + "/queries.txt", dictionaryPath = config.dir + "/dictionary.bitcask";
+
+    DictionaryGenerator generator(config.keys, config.keyLength, config.meaningLength, config.seed);
+    BITCASK_LOG(Info, "Generating " << config.keys << " keys into " << csvPath);
+    if (generator.WriteCsv(csvPath, 1, 0) == 0)
+    {
+        std::cerr << "Failed to write " << csvPath << std::endl;
+        return 1;
+    }
+    std::vector<std::string> queries(config.queries);
+    {
+        std::vector<uint64_t> indices = MakeQueries(config);
+        for (size_t i = 0; i < indices.size(); ++i)
+            generator.Key(indices[i], queries[i]);
+    }
+
+    if (generateOnly || runs("lookup"))
+    {
+        // One query per line, the input --search-batch and --serve take
+        std::ofstream out(queriesPath, std::ios::binary);
+        for (const auto &query : queries)
+            out << query << '\n';
+        if (!out.flush())
+        {
+            std::cerr << "Failed to write " << queriesPath << std::endl;
+            return 1;
+        }
+        if (generateOnly)
+        {
+            BITCASK_LOG(Warn, "Wrote " << csvPath << " and " << queriesPath);
+            return 0;
+        }
+    }
+
+    if (runs("build"))
+        BenchBuild(config, csvPath, dictionaryPath);
+    else
+        CreateDictionary(csvPath, dictionaryPath, config.threads);
+
+    if (runs("lookup"))
+    {
+        for (bool loadIndex : {false, true})
+        {
+            BenchColdLookups(config, queries, dictionaryPath, loadIndex);
+            BenchWarmLookups(config, queries, dictionaryPath, loadIndex);
+            BenchBatchLookups(config, queriesPath, dictionaryPath, loadIndex);
+        }
+    }
+    if (runs("read"))
+    {
+        BenchRead(config, dictionaryPath, false);
+        BenchRead(config, dictionaryPath, true);
+        BenchExport(config, dictionaryPath);
+    }
+    if (runs("merge"))
+        BenchMerge(config, generator, dictionaryPath);
+
+    // Remove only what the run wrote, and the directory if that leaves it empty
+    if (!keep)
+    {
+        std::error_code error;
+        for (const char *name : {"words.csv", "queries.txt", "updates.csv", "dictionary.config"})
+            std::filesystem::remove(config.dir + "/" + name, error);
+        for (std::string name : {"dictionary", "updates", "merged"})
+        {
+            std::string path = config.dir + "/" + name + ".bitcask";
+            for (const auto &file : DictionaryShardFiles(path))
+            {
+                std::filesystem::remove(file, error);
+                std::filesystem::remove(HintPathFor(file), error);
+            }
+            std::filesystem::remove(path, error);
+            std::filesystem::remove(HintPathFor(path), error);
+        }
+        std::filesystem::remove(config.dir, error);
+    }
+    return 0;
+}
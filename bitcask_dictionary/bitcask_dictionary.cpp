@@ -2,20 +2,335 @@
 #include <fstream>
 #include <sstream>
 #include <vector>
+#include <list>
 #include <map>
+#include <unordered_map>
 #include <string>
+#include <string_view>
+#include <optional>
+#include <tuple>
 #include <filesystem>
 #include <csignal>
 #include <iomanip>
 #include <algorithm>
 #include <chrono>
 #include <cstring>
+#include <cerrno>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <queue>
+#include <atomic>
+#include <memory>
+#include <cmath>
+#include <charconv>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <zlib.h>
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
 
 std::string dictPath;
 std::string version;
 std::string configPath = "dictionary.config";
-std::unordered_map<std::string, std::pair<uint64_t, uint32_t>> inMemoryIndex;
+std::map<std::string, std::pair<uint64_t, uint32_t>> inMemoryIndex; // Key order, so --read-dict --fast-read lists words sorted
 bool fastRead = false;
+bool verifyReads = false; // Check the checksum of every record a lookup reads
+bool compressData = false; // Write new dictionaries with a compressed data section
+double filterFalsePositiveRate = 0.01; // Target false-positive rate of the Bloom filter, 0 writes none
+bool buildPerfectHash = false; // --perfect-hash: new dictionaries carry a minimal perfect hash index
+size_t meaningCacheBytes = 0; // --cache budget of the server's meaning cache, 0 for none
+bool reclaimVersions = false; // --serve removes a replaced version's files once its last reader lets go
+uint32_t dictionaryShards = 0; // --shards: shard files --create-dict, --merge-dict and --compact write, 0 to keep the inputs' layout
+size_t sortMemoryBudget = 1024 * 1024 * 1024; // Index bytes --create-dict holds before spilling a sorted run, 0 for no limit
+const unsigned kMaxThreads = 4096; // Largest --threads value accepted
+
+const uint32_t kBitcaskMagic = 0x4B435442;   // "BTCK", marks the extended header
+const uint32_t kFormatSortedIndex = 2;        // Sorted index with slots and fence tables
+const uint32_t kFormatCrc32c = 3;             // Record checksums are CRC32C instead of a byte sum
+const uint32_t kFormatBlocks = 4;             // Header describes an optionally compressed data section
+const uint32_t kFormatFrontCoded = 5;         // Index entries are front-coded varints grouped between restart points
+const uint32_t kFormatBloom = 6;              // Header can point at a Bloom filter over every word
+const uint32_t kFormatPerfectHash = 7;        // Header can point at a minimal perfect hash over every word
+const uint32_t kCurrentFormatVersion = kFormatPerfectHash;
+const uint32_t kRestartInterval = 16;         // Index entries from one full key to the next
+const uint32_t kCompressionNone = 0;          // Data section is a plain sequence of records
+const uint32_t kCompressionDeflate = 1;       // Records are grouped into raw deflate blocks sharing a preset dictionary
+const uint32_t kMinFenceInterval = 64;        // Fewest index entries covered by one fence, a multiple of kRestartInterval
+const uint32_t kMaxFenceCount = 4096;         // Keeps the fence table small enough for a single read
+
+// Log levels. BITCASK_LOG(level, a << b) writes one line to stderr when the level is enabled at
+// runtime (--log-level). Levels above BITCASK_MAX_LOG_LEVEL are compiled out, arguments and all;
+// below it, a disabled message costs one branch and its arguments are never evaluated.
+enum class LogLevel
+{
+    Error,
+    Warn,
+    Info,
+    Debug,
+    Trace
+};
+
+#ifndef BITCASK_MAX_LOG_LEVEL
+#define BITCASK_MAX_LOG_LEVEL 4 // Trace
+#endif
+
+LogLevel logLevel = LogLevel::Info;
+std::mutex logMutex;
+
+constexpr bool LogCompiled(LogLevel level) { return static_cast<int>(level) <= BITCASK_MAX_LOG_LEVEL; }
+inline bool LogEnabled(LogLevel level) { return level <= logLevel; }
+
+bool ParseLogLevel(const std::string &name, LogLevel &level)
+{
+    static const char *const names[] = {"error", "warn", "info", "debug", "trace"};
+    for (int i = 0; i < 5; ++i)
+    {
+        if (name == names[i])
+        {
+            level = static_cast<LogLevel>(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+// Each thread formats into its own stream, reused across messages
+std::ostringstream &LogLine()
+{
+    thread_local std::ostringstream line;
+    line.str(std::string());
+    return line;
+}
+
+// Lines go through the buffered std::clog under a lock, so threads never interleave within a line.
+// Debug and trace output is left to the buffer; anything rarer is flushed straight away.
+void WriteLogLine(LogLevel level, std::ostringstream &line)
+{
+    line << '\n';
+    std::lock_guard<std::mutex> lock(logMutex);
+    std::clog << line.str();
+    if (level <= LogLevel::Info)
+        std::clog.flush();
+}
+
+#define BITCASK_LOG(level, message)                        \
+    do                                                     \
+    {                                                      \
+        if constexpr (LogCompiled(LogLevel::level))        \
+        {                                                  \
+            if (LogEnabled(LogLevel::level))               \
+            {                                              \
+                std::ostringstream &logLine = LogLine();   \
+                logLine << message;                        \
+                WriteLogLine(LogLevel::level, logLine);    \
+            }                                              \
+        }                                                  \
+    } while (0)
+
+// Metrics for --stats: counters and latency histograms, dumped as JSON when the command ends.
+// Each thread records into its own shard, so lookups on different threads never share a cache
+// line, and nothing is recorded unless --stats is given.
+bool statsEnabled = false;
+
+enum class Counter
+{
+    Lookups,
+    Hits,
+    Misses,
+    FilterRejects,  // Lookups the Bloom filter answered
+    WordsScanned,   // Words visited by --prefix and --range
+    BytesRead,      // Bytes fetched from dictionary files, through reads or a mapping
+    ReadCalls,      // Read system calls on dictionary files
+    RecordsWritten, // Records appended to data sections and active segments
+    CacheHits,      // Lookups answered by the meaning cache
+    CacheMisses,    // Lookups the meaning cache could not answer
+    Count
+};
+
+enum class Latency
+{
+    Lookup,     // One Dictionary::Get
+    BatchChunk, // Resolving and reading one chunk of --search-batch
+    Count
+};
+
+// Log-linear histogram of nanosecond latencies: 16 buckets per power of two, so a reported
+// percentile is within 1/16 of the true value
+class LatencyHistogram
+{
+public:
+    static constexpr int kSubBuckets = 16;
+    static constexpr int kBuckets = 61 * kSubBuckets;
+
+    void Record(uint64_t nanoseconds)
+    {
+        buckets[BucketOf(nanoseconds)]++;
+        count++;
+        total += nanoseconds;
+        maximum = std::max(maximum, nanoseconds);
+    }
+
+    void Add(const LatencyHistogram &other)
+    {
+        for (int i = 0; i < kBuckets; ++i)
+            buckets[i] += other.buckets[i];
+        count += other.count;
+        total += other.total;
+        maximum = std::max(maximum, other.maximum);
+    }
+
+    uint64_t Count() const { return count; }
+    uint64_t Mean() const { return count ? total / count : 0; }
+    uint64_t Max() const { return maximum; }
+
+    // Upper bound of the bucket holding the given fraction of samples
+    uint64_t Percentile(double fraction) const
+    {
+        uint64_t rank = static_cast<uint64_t>(std::ceil(fraction * count));
+        uint64_t seen = 0;
+        for (int i = 0; i < kBuckets; ++i)
+        {
+            seen += buckets[i];
+            if (seen >= std::max<uint64_t>(rank, 1))
+                return std::min(BucketStart(i + 1) - 1, maximum);
+        }
+        return maximum;
+    }
+
+private:
+    static int BucketOf(uint64_t value)
+    {
+        if (value < kSubBuckets)
+            return static_cast<int>(value);
+        int msb = 63 - __builtin_clzll(value);
+        return (msb - 3) * kSubBuckets + static_cast<int>((value >> (msb - 4)) & (kSubBuckets - 1));
+    }
+
+    static uint64_t BucketStart(int bucket)
+    {
+        if (bucket < kSubBuckets)
+            return static_cast<uint64_t>(bucket);
+        int msb = bucket / kSubBuckets + 3;
+        return static_cast<uint64_t>(kSubBuckets + bucket % kSubBuckets) << (msb - 4);
+    }
+
+    uint64_t buckets[kBuckets] = {};
+    uint64_t count = 0;
+    uint64_t total = 0;
+    uint64_t maximum = 0;
+};
+
+class Metrics
+{
+public:
+    void Add(Counter counter, uint64_t amount = 1)
+    {
+        if (statsEnabled)
+            LocalShard().counters[static_cast<int>(counter)].fetch_add(amount, std::memory_order_relaxed);
+    }
+
+    void Record(Latency latency, uint64_t nanoseconds)
+    {
+        if (!statsEnabled)
+            return;
+        Shard &shard = LocalShard();
+        std::lock_guard<std::mutex> lock(shard.histogramMutex); // Only contended while dumping
+        shard.latencies[static_cast<int>(latency)].Record(nanoseconds);
+    }
+
+    void WriteJson(std::ostream &out, const std::string &command, double elapsedSeconds)
+    {
+        static const char *const counterNames[] = {"lookups", "hits", "misses", "filter_rejects", "words_scanned",
+                                                   "bytes_read", "read_calls", "records_written", "cache_hits", "cache_misses"};
+        static const char *const latencyNames[] = {"lookup", "batch_chunk"};
+
+        uint64_t counters[static_cast<int>(Counter::Count)] = {};
+        std::vector<LatencyHistogram> latencies(static_cast<int>(Latency::Count));
+        {
+            std::lock_guard<std::mutex> lock(shardsMutex);
+            for (const auto &shard : shards)
+            {
+                for (int i = 0; i < static_cast<int>(Counter::Count); ++i)
+                    counters[i] += shard->counters[i].load(std::memory_order_relaxed);
+                std::lock_guard<std::mutex> histogramLock(shard->histogramMutex);
+                for (int i = 0; i < static_cast<int>(Latency::Count); ++i)
+                    latencies[i].Add(shard->latencies[i]);
+            }
+        }
+
+        out << "{\"command\":\"" << command << "\",\"elapsed_seconds\":" << std::fixed << std::setprecision(6) << elapsedSeconds
+            << ",\"counters\":{";
+        for (int i = 0; i < static_cast<int>(Counter::Count); ++i)
+            out << (i ? "," : "") << '"' << counterNames[i] << "\":" << counters[i];
+        out << "},\"latency_ns\":{";
+        for (int i = 0; i < static_cast<int>(Latency::Count); ++i)
+        {
+            const LatencyHistogram &h = latencies[i];
+            out << (i ? "," : "") << '"' << latencyNames[i] << "\":{\"count\":" << h.Count() << ",\"mean\":" << h.Mean()
+                << ",\"p50\":" << h.Percentile(0.5) << ",\"p99\":" << h.Percentile(0.99) << ",\"p999\":" << h.Percentile(0.999)
+                << ",\"max\":" << h.Max() << "}";
+        }
+        out << "}}" << std::endl;
+    }
+
+private:
+    struct alignas(64) Shard
+    {
+        std::atomic<uint64_t> counters[static_cast<int>(Counter::Count)] = {};
+        std::mutex histogramMutex;
+        LatencyHistogram latencies[static_cast<int>(Latency::Count)];
+    };
+
+    // Shards outlive their threads, so counts from finished workers are still dumped
+    Shard &LocalShard()
+    {
+        thread_local Shard *shard = nullptr;
+        if (!shard)
+        {
+            std::lock_guard<std::mutex> lock(shardsMutex);
+            shards.push_back(std::make_unique<Shard>());
+            shard = shards.back().get();
+        }
+        return *shard;
+    }
+
+    std::mutex shardsMutex;
+    std::vector<std::unique_ptr<Shard>> shards;
+};
+
+Metrics metrics;
+
+// Records the lifetime of a scope into a latency histogram; reads no clock without --stats
+class ScopedLatency
+{
+public:
+    explicit ScopedLatency(Latency latency) : latency(latency)
+    {
+        if (statsEnabled)
+            start = std::chrono::steady_clock::now();
+    }
+    ~ScopedLatency()
+    {
+        if (statsEnabled)
+            metrics.Record(latency, std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+    }
+
+private:
+    Latency latency;
+    std::chrono::steady_clock::time_point start;
+};
 
 #pragma pack(push, 1)
 struct BitcaskHeader
@@ -25,580 +340,5770 @@ struct BitcaskHeader
     uint64_t dataOffset;  // Offset where the data section starts
     uint32_t entryCount;  // Number of entries in the dictionary
 
+    // Extended header. Legacy files stop after entryCount and their data section starts right there,
+    // so dataOffset always tells how many header bytes are stored in the file.
+    uint32_t magic = kBitcaskMagic;                  // kBitcaskMagic when the extended header is present
+    uint32_t formatVersion = kCurrentFormatVersion;  // On-disk layout version
+    uint64_t fenceOffset = 0;                        // Sparse table of every fenceInterval-th key
+    uint32_t fenceCount = 0;                         // Number of fences
+    uint32_t fenceInterval = 0;                      // Index entries covered by each fence
+    uint64_t slotsOffset = 0;                        // Fixed-width offsets of every restart point (every entry before format 5)
+    uint32_t compression = kCompressionNone;         // How the data section is stored
+    uint32_t blockCount = 0;                         // Compressed blocks in the data section
+    uint64_t blockTableOffset = 0;                   // Offset and sizes of every compressed block
+    uint64_t presetOffset = 0;                       // Preset dictionary shared by all blocks
+    uint32_t presetSize = 0;
+    uint32_t restartInterval = 0;                    // Index entries per restart point when front-coded
+    uint64_t filterOffset = 0;                       // Blocked Bloom filter over every word
+    uint32_t filterBlocks = 0;                       // 64-byte filter blocks, 0 when there is no filter
+    uint32_t filterProbes = 0;                       // Bits each word sets inside its block
+    uint64_t perfectHashOffset = 0;                  // Levels of a minimal perfect hash over every word
+    uint32_t perfectHashLevels = 0;                  // 0 when there is no perfect hash
+    uint64_t perfectHashSlotsOffset = 0;             // Location and block size of every word, in perfect hash order
+
+    static constexpr size_t kLegacySize = sizeof(uint32_t) + 2 * sizeof(uint64_t) + sizeof(uint32_t);
+
+    // Number of header bytes stored in a file whose data section starts at dataOffset
+    size_t StoredSize() const
+    {
+        return static_cast<size_t>(std::clamp<uint64_t>(dataOffset, kLegacySize, sizeof(BitcaskHeader)));
+    }
+
+    bool HasSortedIndex() const { return magic == kBitcaskMagic && formatVersion >= kFormatSortedIndex; }
+    bool HasCrc32c() const { return magic == kBitcaskMagic && formatVersion >= kFormatCrc32c; }
+    bool HasFrontCodedIndex() const { return magic == kBitcaskMagic && formatVersion >= kFormatFrontCoded; }
+    uint32_t RestartInterval() const { return HasFrontCodedIndex() ? std::max(restartInterval, 1u) : 1; }
+    uint32_t RestartCount() const { return (entryCount + RestartInterval() - 1) / RestartInterval(); }
+    bool HasCompressedBlocks() const { return magic == kBitcaskMagic && formatVersion >= kFormatBlocks && compression != kCompressionNone; }
+    bool HasFilter() const { return magic == kBitcaskMagic && formatVersion >= kFormatBloom && filterBlocks > 0; }
+    bool HasPerfectHash() const { return magic == kBitcaskMagic && formatVersion >= kFormatPerfectHash && perfectHashLevels > 0; }
+
     void WriteToFile(std::ofstream &out)
     {
-        out.write(reinterpret_cast<const char *>(&version), sizeof(version));
-        out.write(reinterpret_cast<const char *>(&indexOffset), sizeof(indexOffset));
-        out.write(reinterpret_cast<const char *>(&dataOffset), sizeof(dataOffset));
-        out.write(reinterpret_cast<const char *>(&entryCount), sizeof(entryCount));
+        out.write(reinterpret_cast<const char *>(this), sizeof(BitcaskHeader));
     }
 
     void ReadFromFile(std::ifstream &in)
     {
-        in.read(reinterpret_cast<char *>(&version), sizeof(version));
-        in.read(reinterpret_cast<char *>(&indexOffset), sizeof(indexOffset));
-        in.read(reinterpret_cast<char *>(&dataOffset), sizeof(dataOffset));
-        in.read(reinterpret_cast<char *>(&entryCount), sizeof(entryCount));
+        std::memset(static_cast<void *>(this), 0, sizeof(BitcaskHeader));
+        in.read(reinterpret_cast<char *>(this), kLegacySize);
+        in.read(reinterpret_cast<char *>(this) + kLegacySize, StoredSize() - kLegacySize);
+    }
+
+    bool ReadFromBuffer(const char *data, size_t available)
+    {
+        std::memset(static_cast<void *>(this), 0, sizeof(BitcaskHeader));
+        if (available < kLegacySize)
+            return false;
+        std::memcpy(this, data, kLegacySize);
+        if (available < StoredSize())
+            return false;
+        std::memcpy(reinterpret_cast<char *>(this) + kLegacySize, data + kLegacySize, StoredSize() - kLegacySize);
+        return true;
     }
 };
 #pragma pack(pop)
 
-// Function to calculate a simple checksum
-uint32_t CalculateChecksum(const std::string &data)
+// Read-only mapping of a whole dictionary file, unmapped when it goes out of scope
+class MappedFile
 {
-    uint32_t checksum = 0;
-    for (char c : data)
+public:
+    MappedFile() = default;
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+    ~MappedFile() { Close(); }
+
+    bool Open(const std::string &path)
     {
-        checksum += c;
+        Close();
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            return false;
+
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size == 0)
+        {
+            close(fd);
+            return false;
+        }
+
+        void *addr = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd); // The mapping stays valid after the descriptor is closed
+        if (addr == MAP_FAILED)
+            return false;
+
+        mappedData = static_cast<const char *>(addr);
+        mappedSize = static_cast<size_t>(st.st_size);
+        return true;
     }
-    return checksum;
-}
 
-// Helper function to write a Bitcask entry
-uint32_t WriteBitcaskEntry(std::ofstream &out, const std::string &word, const std::string &meaning)
-{
-    uint32_t checksum = CalculateChecksum(word + meaning);
-    uint32_t wordSize = word.size();
-    uint32_t meaningSize = meaning.size();
+    void Close()
+    {
+        if (mappedData)
+        {
+            munmap(const_cast<char *>(mappedData), mappedSize);
+            mappedData = nullptr;
+            mappedSize = 0;
+        }
+    }
 
-    // Write entry in the format: [checksum][wordSize][meaningSize][word][meaning]
-    out.write(reinterpret_cast<const char *>(&checksum), sizeof(checksum));
-    std::cout << "Write checksum (" << checksum << ") for word: '" << word << "', size: " << sizeof(checksum) << " bytes\n";
+    const char *Data() const { return mappedData; }
+    size_t Size() const { return mappedSize; }
 
-    out.write(reinterpret_cast<const char *>(&wordSize), sizeof(wordSize));
-    std::cout << "Write word size (" << wordSize << ") for word: '" << word << "', size: " << sizeof(wordSize) << " bytes\n";
+private:
+    const char *mappedData = nullptr;
+    size_t mappedSize = 0;
+};
 
-    out.write(reinterpret_cast<const char *>(&meaningSize), sizeof(meaningSize));
-    std::cout << "Write meaning size (" << meaningSize << ") for word: '" << word << "', size: " << sizeof(meaningSize) << " bytes\n";
+// A data record parsed in place: [checksum][wordSize][meaningSize][word][meaning]
+struct RecordView
+{
+    uint32_t checksum;
+    std::string_view word;
+    std::string_view meaning;
+};
 
-    out.write(word.c_str(), wordSize);
-    std::cout << "Write word: '" << word << "', size: " << wordSize << " bytes\n";
+bool ParseRecord(const char *data, size_t available, RecordView &record)
+{
+    uint32_t wordSize, meaningSize;
+    const size_t fixedSize = sizeof(record.checksum) + sizeof(wordSize) + sizeof(meaningSize);
+    if (available < fixedSize)
+        return false;
 
-    out.write(meaning.c_str(), meaningSize);
+    std::memcpy(&record.checksum, data, sizeof(record.checksum));
+    std::memcpy(&wordSize, data + sizeof(record.checksum), sizeof(wordSize));
+    std::memcpy(&meaningSize, data + sizeof(record.checksum) + sizeof(wordSize), sizeof(meaningSize));
+    if (available - fixedSize < static_cast<uint64_t>(wordSize) + meaningSize)
+        return false;
 
-    // Return the total size of the block written
-    return sizeof(checksum) + sizeof(wordSize) + sizeof(meaningSize) + wordSize + meaningSize;
+    record.word = std::string_view(data + fixedSize, wordSize);
+    record.meaning = std::string_view(data + fixedSize + wordSize, meaningSize);
+    return true;
 }
 
-void CreateDictionary(const std::string &csvFilePath, const std::string &bitcaskFilePath)
+// Byte sum of word and meaning, the record checksum before format version 3
+uint32_t LegacyChecksum(std::string_view word, std::string_view meaning)
 {
-    std::ifstream inFile(csvFilePath);
-    std::ofstream outFile(bitcaskFilePath, std::ios::binary);
+    uint32_t checksum = 0;
+    for (char c : word)
+        checksum += c;
+    for (char c : meaning)
+        checksum += c;
+    return checksum;
+}
 
-    BitcaskHeader header = {static_cast<uint32_t>(std::stoi(version)), 0, 0, 0}; // Initialize header with defaults
-    outFile.seekp(sizeof(BitcaskHeader));                                        // Reserve space for the header
+// CRC32C (Castagnoli). Crc32c extends a finished checksum with more bytes, so a record can be
+// checksummed piece by piece; start from 0. Uses the SSE4.2 crc32 instruction when the CPU has it.
+const uint32_t kCrc32cPolynomial = 0x82F63B78; // Reflected
 
-    std::string line;
-    std::vector<std::tuple<std::string, uint64_t, uint32_t>> index; // Store index entries with word, offset, and block size
-    uint64_t dataStart = outFile.tellp();
+struct Crc32cTable
+{
+    uint32_t entries[256];
 
-    // Read the CSV and write data entries
-    while (std::getline(inFile, line))
+    Crc32cTable()
     {
-        std::istringstream ss(line);
-        std::string word, meaning;
-        if (std::getline(ss, word, ',') && std::getline(ss, meaning))
+        for (uint32_t i = 0; i < 256; ++i)
         {
-            uint64_t currentOffset = static_cast<uint64_t>(outFile.tellp());
+            uint32_t crc = i;
+            for (int bit = 0; bit < 8; ++bit)
+                crc = (crc >> 1) ^ ((crc & 1) ? kCrc32cPolynomial : 0);
+            entries[i] = crc;
+        }
+    }
+};
 
-            // Write the Bitcask entry and get its size
-            uint32_t blockSize = WriteBitcaskEntry(outFile, word, meaning);
-            std::cout << "Writing entry for word: '" << word << "' at offset: " << currentOffset << ", block size: " << blockSize << "\n";
+uint32_t Crc32cSoftware(uint32_t crc, const unsigned char *data, size_t size)
+{
+    static const Crc32cTable table;
+    while (size-- > 0)
+        crc = table.entries[(crc ^ *data++) & 0xFF] ^ (crc >> 8);
+    return crc;
+}
 
-            // Store the index with the block size
-            index.push_back({word, currentOffset, blockSize});
-            header.entryCount++;
-        }
+#if defined(__x86_64__)
+__attribute__((target("sse4.2"))) uint32_t Crc32cHardware(uint32_t crc, const unsigned char *data, size_t size)
+{
+    uint64_t crc64 = crc;
+    while (size >= sizeof(uint64_t))
+    {
+        uint64_t word;
+        std::memcpy(&word, data, sizeof(word));
+        crc64 = _mm_crc32_u64(crc64, word);
+        data += sizeof(word);
+        size -= sizeof(word);
     }
+    crc = static_cast<uint32_t>(crc64);
+    while (size-- > 0)
+        crc = _mm_crc32_u8(crc, *data++);
+    return crc;
+}
+#endif
+
+uint32_t Crc32c(const void *data, size_t size, uint32_t crc = 0)
+{
+    const unsigned char *bytes = static_cast<const unsigned char *>(data);
+#if defined(__x86_64__)
+    static const bool hardware = __builtin_cpu_supports("sse4.2");
+    if (hardware)
+        return ~Crc32cHardware(~crc, bytes, size);
+#endif
+    return ~Crc32cSoftware(~crc, bytes, size);
+}
+
+// Checksum of a version 3 record: CRC32C of everything after the checksum field,
+// [wordSize][meaningSize][word][meaning]
+uint32_t RecordChecksum(uint32_t wordSize, uint32_t meaningSize, std::string_view word, std::string_view meaning)
+{
+    uint32_t sizes[2] = {wordSize, meaningSize};
+    uint32_t crc = Crc32c(sizes, sizeof(sizes));
+    crc = Crc32c(word.data(), word.size(), crc);
+    return Crc32c(meaning.data(), meaning.size(), crc);
+}
+
+// Check a parsed record against the checksum scheme of its file's format
+bool VerifyRecord(const RecordView &record, bool crc32c)
+{
+    uint32_t expected = crc32c ? RecordChecksum(record.word.size(), record.meaning.size(), record.word, record.meaning)
+                               : LegacyChecksum(record.word, record.meaning);
+    return expected == record.checksum;
+}
 
-    uint64_t indexStart = outFile.tellp();
-    std::cout << "Index section starts at offset: " << indexStart << "\n";
+// How dictionary files are read. Each command picks its own default, and --io overrides it.
+enum class IoBackend
+{
+    Stream, // Seek and read on one std::ifstream, one read at a time
+    Pread,  // Positional reads on a shared descriptor
+    Mmap,   // Parse the mapped file in place
+    Uring   // Positional reads, with batches kept in flight together through io_uring
+};
+
+std::optional<IoBackend> ioBackend; // --io, or its shorthands --mmap and --pread
+bool directIo = false; // --direct: merges read their inputs around the page cache and drop their output from it
+
+IoBackend ReadBackend(IoBackend commandDefault)
+{
+    return ioBackend.value_or(commandDefault);
+}
 
-    // Write the index section with block size included
-    for (const auto &entry : index)
+bool ParseIoBackend(const std::string &name, IoBackend &backend)
+{
+    static const std::pair<const char *, IoBackend> names[] = {
+        {"stream", IoBackend::Stream}, {"pread", IoBackend::Pread}, {"mmap", IoBackend::Mmap}, {"uring", IoBackend::Uring}};
+    for (const auto &entry : names)
     {
-        uint32_t wordSize = std::get<0>(entry).size();
-        outFile.write(reinterpret_cast<const char *>(&wordSize), sizeof(wordSize));
-        outFile.write(std::get<0>(entry).c_str(), wordSize);
-        outFile.write(reinterpret_cast<const char *>(&std::get<1>(entry)), sizeof(uint64_t)); // Offset
-        outFile.write(reinterpret_cast<const char *>(&std::get<2>(entry)), sizeof(uint32_t)); // Block size
-        std::cout << "Index entry for word: '" << std::get<0>(entry) << "', offset: " << std::get<1>(entry) << ", block size: " << std::get<2>(entry) << "\n";
+        if (name == entry.first)
+        {
+            backend = entry.second;
+            return true;
+        }
     }
+    return false;
+}
 
-    // Update header with correct offsets
-    header.indexOffset = indexStart;
-    header.dataOffset = dataStart;
-    outFile.seekp(0); // Go back to the start to write the header
-    header.WriteToFile(outFile);
+const char *IoBackendName(IoBackend backend)
+{
+    switch (backend)
+    {
+    case IoBackend::Stream:
+        return "stream";
+    case IoBackend::Pread:
+        return "pread";
+    case IoBackend::Mmap:
+        return "mmap";
+    case IoBackend::Uring:
+        return "uring";
+    }
+    return "unknown";
+}
 
-    std::cout << "Header updated with data offset: " << header.dataOffset
-              << ", index offset: " << header.indexOffset
-              << ", entry count: " << header.entryCount << "\n";
+// One read of a batch; ok tells whether all size bytes arrived
+struct ReadRequest
+{
+    uint64_t offset;
+    size_t size;
+    char *destination;
+    bool ok = false;
+};
 
-    inFile.close();
-    outFile.close();
+bool PreadFully(int fd, char *destination, size_t size, uint64_t offset)
+{
+    size_t done = 0;
+    while (done < size)
+    {
+        ssize_t n = pread(fd, destination + done, size - done, static_cast<off_t>(offset + done));
+        metrics.Add(Counter::ReadCalls);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        done += static_cast<size_t>(n);
+    }
+    return true;
 }
 
-void LoadIndex(const std::string &dictPath)
+const unsigned kUringQueueDepth = 64; // Reads io_uring keeps in flight at once
+
+// A minimal io_uring set up with raw system calls, so there is no liburing dependency. Rings are
+// single-producer, so each thread gets its own, created on first use; the reads of a batch are
+// submitted together and reaped as they complete, kUringQueueDepth at a time.
+class UringQueue
 {
-    std::ifstream inFile(dictPath, std::ios::binary);
-    if (!inFile.is_open())
+public:
+    UringQueue(const UringQueue &) = delete;
+    UringQueue &operator=(const UringQueue &) = delete;
+    ~UringQueue()
     {
-        std::cerr << "Failed to open dictionary file " << dictPath << " for index loading." << std::endl;
-        return;
+        if (sqes)
+            munmap(sqes, sqesSize);
+        if (cqRing && cqRing != sqRing)
+            munmap(cqRing, cqRingSize);
+        if (sqRing)
+            munmap(sqRing, sqRingSize);
+        if (ringFd >= 0)
+            close(ringFd);
     }
 
-    BitcaskHeader header;
-    header.ReadFromFile(inFile); // Read the header to get index offset and entry count
-    inFile.seekg(header.indexOffset);
+    // The calling thread's ring, or nullptr when the kernel refuses io_uring, as seccomp
+    // profiles often make it do
+    static UringQueue *ForThread()
+    {
+        thread_local std::unique_ptr<UringQueue> queue;
+        thread_local bool tried = false;
+        if (!tried)
+        {
+            tried = true;
+            queue.reset(new UringQueue());
+            if (!queue->Setup(kUringQueueDepth))
+            {
+                static std::once_flag warned;
+                std::call_once(warned, [] { BITCASK_LOG(Warn, "io_uring is unavailable (" << std::strerror(errno) << "), reading with pread instead."); });
+                queue.reset();
+            }
+        }
+        return queue.get();
+    }
 
-    for (uint32_t i = 0; i < header.entryCount; ++i)
+    // Read every request from fd, keeping up to the queue depth in flight. Short reads are
+    // resubmitted for the rest, and a request the kernel cannot queue falls back to pread.
+    void ReadAll(int fd, std::vector<ReadRequest> &requests)
     {
-        uint32_t wordSize;
-        inFile.read(reinterpret_cast<char *>(&wordSize), sizeof(wordSize));
+        struct Pending
+        {
+            size_t request;
+            size_t done;
+        };
+        std::vector<Pending> slots(entries);
+        std::vector<unsigned> freeSlots;
+        for (unsigned i = 0; i < entries; ++i)
+            freeSlots.push_back(entries - 1 - i);
 
-        std::string storedWord(wordSize, '\0');
-        inFile.read(&storedWord[0], wordSize);
+        size_t next = 0, inFlight = 0;
+        while (next < requests.size() || inFlight > 0)
+        {
+            unsigned queued = 0;
+            for (; next < requests.size() && !freeSlots.empty(); ++next)
+            {
+                unsigned slot = freeSlots.back();
+                freeSlots.pop_back();
+                slots[slot] = {next, 0};
+                Queue(fd, requests[next], 0, slot);
+                queued++;
+            }
+            inFlight += queued;
+            if (Enter(queued, inFlight > 0 ? 1 : 0) < 0)
+            {
+                // The ring is unusable; finish what is left synchronously
+                for (size_t i = 0; i < requests.size(); ++i)
+                {
+                    if (!requests[i].ok)
+                        requests[i].ok = PreadFully(fd, requests[i].destination, requests[i].size, requests[i].offset);
+                }
+                return;
+            }
 
-        uint64_t dataOffset;
-        inFile.read(reinterpret_cast<char *>(&dataOffset), sizeof(dataOffset));
+            unsigned head = *cqHead;
+            unsigned tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+            queued = 0;
+            for (; head != tail; ++head)
+            {
+                const io_uring_cqe &cqe = cqes[head & *cqMask];
+                unsigned slot = static_cast<unsigned>(cqe.user_data);
+                ReadRequest &request = requests[slots[slot].request];
+                metrics.Add(Counter::ReadCalls);
+                if (cqe.res > 0 && slots[slot].done + cqe.res < request.size)
+                {
+                    slots[slot].done += static_cast<size_t>(cqe.res);
+                    Queue(fd, request, slots[slot].done, slot);
+                    queued++;
+                    continue;
+                }
+                if (cqe.res > 0)
+                    request.ok = true;
+                else if (cqe.res == -EINTR || cqe.res == -EAGAIN || cqe.res == -EINVAL || cqe.res == -EOPNOTSUPP)
+                    request.ok = PreadFully(fd, request.destination + slots[slot].done, request.size - slots[slot].done, request.offset + slots[slot].done);
+                freeSlots.push_back(slot);
+                inFlight--;
+            }
+            __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+            if (queued > 0 && Enter(queued, 0) < 0)
+                return;
+        }
+    }
 
-        uint32_t blockSize;
-        inFile.read(reinterpret_cast<char *>(&blockSize), sizeof(blockSize));
+private:
+    UringQueue() = default;
+
+    bool Setup(unsigned depth)
+    {
+        io_uring_params params = {};
+        ringFd = static_cast<int>(syscall(__NR_io_uring_setup, depth, &params));
+        if (ringFd < 0)
+            return false;
+        entries = params.sq_entries;
+
+        sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        bool singleMap = params.features & IORING_FEAT_SINGLE_MMAP;
+        if (singleMap)
+            sqRingSize = cqRingSize = std::max(sqRingSize, cqRingSize);
+        sqRing = mmap(nullptr, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQ_RING);
+        if (sqRing == MAP_FAILED)
+        {
+            sqRing = nullptr;
+            return false;
+        }
+        cqRing = singleMap ? sqRing : mmap(nullptr, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_CQ_RING);
+        if (cqRing == MAP_FAILED)
+        {
+            cqRing = nullptr;
+            return false;
+        }
+        sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+        void *mappedSqes = mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQES);
+        if (mappedSqes == MAP_FAILED)
+            return false;
+        sqes = static_cast<io_uring_sqe *>(mappedSqes);
 
-        inMemoryIndex[storedWord] = {dataOffset, blockSize}; // Store both offset and block size
+        char *sq = static_cast<char *>(sqRing), *cq = static_cast<char *>(cqRing);
+        sqTail = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+        sqMask = reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+        sqArray = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+        cqHead = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+        cqTail = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+        cqMask = reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+        cqes = reinterpret_cast<io_uring_cqe *>(cq + params.cq_off.cqes);
+        return true;
     }
 
-    inFile.close();
-    std::cout << "Index loaded into memory with " << inMemoryIndex.size() << " entries." << std::endl;
-}
+    // Fill the next submission entry; the kernel sees it once Enter publishes the tail
+    void Queue(int fd, const ReadRequest &request, size_t done, unsigned slot)
+    {
+        unsigned tail = *sqTail;
+        unsigned index = tail & *sqMask;
+        io_uring_sqe &sqe = sqes[index];
+        std::memset(&sqe, 0, sizeof(sqe));
+        sqe.opcode = IORING_OP_READ;
+        sqe.fd = fd;
+        sqe.off = request.offset + done;
+        sqe.addr = reinterpret_cast<uint64_t>(request.destination + done);
+        sqe.len = static_cast<uint32_t>(std::min<size_t>(request.size - done, UINT32_MAX));
+        sqe.user_data = slot;
+        sqArray[index] = index;
+        __atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+    }
+
+    int Enter(unsigned submit, unsigned waitFor)
+    {
+        while (true)
+        {
+            long n = syscall(__NR_io_uring_enter, ringFd, submit, waitFor, waitFor > 0 ? IORING_ENTER_GETEVENTS : 0, nullptr, 0);
+            if (n >= 0 || errno != EINTR)
+                return static_cast<int>(n);
+        }
+    }
 
-void ReadDictionary(const std::string &bitcaskFilePath)
+    int ringFd = -1;
+    unsigned entries = 0;
+    void *sqRing = nullptr, *cqRing = nullptr;
+    size_t sqRingSize = 0, cqRingSize = 0, sqesSize = 0;
+    io_uring_sqe *sqes = nullptr;
+    io_uring_cqe *cqes = nullptr;
+    unsigned *sqTail = nullptr, *sqMask = nullptr, *sqArray = nullptr;
+    unsigned *cqHead = nullptr, *cqTail = nullptr, *cqMask = nullptr;
+};
+
+const size_t kDirectAlignment = 4096; // Offset, length and buffer alignment O_DIRECT reads need
+
+// Read access to a whole file through the chosen backend. Nothing changes after Open, so one
+// reader can be shared by any number of threads; the stream backend serializes its reads.
+// A direct reader opens the file with O_DIRECT, so reads neither use nor fill the page cache,
+// and reads whole aligned pages into a bounce buffer. Filesystems without O_DIRECT, like tmpfs,
+// get an ordinary descriptor.
+class FileReader
 {
-    std::ifstream inFile(bitcaskFilePath, std::ios::binary);
-    if (!inFile)
+public:
+    FileReader() = default;
+    FileReader(const FileReader &) = delete;
+    FileReader &operator=(const FileReader &) = delete;
+    ~FileReader()
     {
-        std::cerr << "Failed to open file: " << bitcaskFilePath << "\n";
-        return;
+        if (fd >= 0)
+            close(fd);
+    }
+
+    bool Open(const std::string &path, IoBackend backend, bool direct = false)
+    {
+        this->backend = backend;
+        if (backend == IoBackend::Mmap)
+        {
+            if (!mapped.Open(path))
+                return false;
+            fileSize = mapped.Size();
+            return true;
+        }
+        if (backend == IoBackend::Stream)
+        {
+            stream.open(path, std::ios::binary);
+            std::error_code error;
+            fileSize = std::filesystem::file_size(path, error);
+            return stream.is_open() && !error;
+        }
+
+        if (direct)
+        {
+            fd = open(path.c_str(), O_RDONLY | O_DIRECT);
+            this->direct = fd >= 0;
+            if (fd < 0)
+                BITCASK_LOG(Debug, "O_DIRECT is not supported for " << path << ", reading it through the page cache.");
+        }
+        if (fd < 0)
+            fd = open(path.c_str(), O_RDONLY);
+        struct stat st;
+        if (fd < 0 || fstat(fd, &st) != 0)
+            return false;
+        fileSize = static_cast<uint64_t>(st.st_size);
+        return true;
+    }
+
+    bool ReadAt(uint64_t offset, size_t size, char *destination) const
+    {
+        if (offset > fileSize || size > fileSize - offset)
+            return false;
+        metrics.Add(Counter::BytesRead, size);
+        switch (backend)
+        {
+        case IoBackend::Mmap:
+            std::memcpy(destination, mapped.Data() + offset, size);
+            return true;
+        case IoBackend::Stream:
+        {
+            std::lock_guard<std::mutex> lock(streamMutex);
+            stream.seekg(static_cast<std::streamoff>(offset));
+            metrics.Add(Counter::ReadCalls);
+            if (stream.read(destination, size))
+                return true;
+            stream.clear();
+            return false;
+        }
+        default:
+            return direct ? ReadDirect(offset, size, destination) : PreadFully(fd, destination, size, offset);
+        }
+    }
+
+    // Read a batch of ranges. io_uring keeps them all in flight; the other backends read them
+    // one after another.
+    void ReadMany(std::vector<ReadRequest> &requests) const
+    {
+        UringQueue *queue = (backend == IoBackend::Uring && !direct) ? UringQueue::ForThread() : nullptr;
+        if (!queue)
+        {
+            for (ReadRequest &request : requests)
+                request.ok = ReadAt(request.offset, request.size, request.destination);
+            return;
+        }
+        for (ReadRequest &request : requests)
+        {
+            request.ok = false;
+            if (request.offset <= fileSize && request.size <= fileSize - request.offset)
+                metrics.Add(Counter::BytesRead, request.size);
+            else
+                request.size = 0; // Out of range: nothing is read and ok stays false
+        }
+        std::vector<ReadRequest> inRange;
+        std::vector<size_t> positions;
+        for (size_t i = 0; i < requests.size(); ++i)
+        {
+            if (requests[i].size > 0)
+            {
+                inRange.push_back(requests[i]);
+                positions.push_back(i);
+            }
+        }
+        queue->ReadAll(fd, inRange);
+        for (size_t i = 0; i < inRange.size(); ++i)
+            requests[positions[i]].ok = inRange[i].ok;
+    }
+
+    // The bytes in place when mapped, otherwise read into scratch; nullptr if out of range
+    const char *Fetch(uint64_t offset, size_t size, std::vector<char> &scratch) const
+    {
+        if (offset > fileSize || size > fileSize - offset)
+            return nullptr;
+        if (mapped.Data())
+        {
+            metrics.Add(Counter::BytesRead, size);
+            return mapped.Data() + offset;
+        }
+        scratch.resize(size);
+        return ReadAt(offset, size, scratch.data()) ? scratch.data() : nullptr;
+    }
+
+    const char *Mapping() const { return mapped.Data(); }
+    int Descriptor() const { return direct ? -1 : fd; } // -1 when mapped, streamed or direct, so ranges are not kernel-copied
+    uint64_t Size() const { return fileSize; }
+
+private:
+    bool ReadDirect(uint64_t offset, size_t size, char *destination) const
+    {
+        struct AlignedFree
+        {
+            void operator()(char *buffer) const { std::free(buffer); }
+        };
+        thread_local std::unique_ptr<char, AlignedFree> bounce;
+        thread_local size_t bounceSize = 0;
+
+        uint64_t alignedStart = offset / kDirectAlignment * kDirectAlignment;
+        size_t alignedSize = static_cast<size_t>((offset + size - alignedStart + kDirectAlignment - 1) / kDirectAlignment * kDirectAlignment);
+        if (bounceSize < alignedSize)
+        {
+            bounce.reset(static_cast<char *>(std::aligned_alloc(kDirectAlignment, alignedSize)));
+            bounceSize = bounce ? alignedSize : 0;
+            if (!bounce)
+                return false;
+        }
+
+        // The last page of the file comes back short
+        size_t needed = static_cast<size_t>(offset + size - alignedStart), done = 0;
+        while (done < needed)
+        {
+            ssize_t n = pread(fd, bounce.get() + done, alignedSize - done, static_cast<off_t>(alignedStart + done));
+            metrics.Add(Counter::ReadCalls);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                return false;
+            done += static_cast<size_t>(n);
+        }
+        std::memcpy(destination, bounce.get() + (offset - alignedStart), size);
+        return true;
+    }
+
+    IoBackend backend = IoBackend::Pread;
+    MappedFile mapped;
+    mutable std::ifstream stream;
+    mutable std::mutex streamMutex;
+    int fd = -1;
+    bool direct = false;
+    uint64_t fileSize = 0;
+};
+
+// A compressed data section groups records into blocks of about kCompressedBlockSize raw bytes.
+// Each block is raw deflate with a preset dictionary sampled from the records, so even small
+// blocks compress well. Index entries point at (block id << 32 | offset in the block), and the
+// block size in the index stays the record size.
+const uint32_t kCompressedBlockSize = 4096;         // Raw record bytes per block
+const size_t kPresetDictionarySize = 32 * 1024;     // Largest preset deflate can use
+const size_t kPresetTrainingBytes = 1024 * 1024;    // Record bytes sampled for the preset dictionary
+
+inline uint64_t BlockLocation(uint32_t block, uint32_t offsetInBlock)
+{
+    return (static_cast<uint64_t>(block) << 32) | offsetInBlock;
+}
+
+#pragma pack(push, 1)
+struct BlockEntry
+{
+    uint64_t offset;         // Where the block starts in the file
+    uint32_t compressedSize; // Equal to rawSize when the block did not compress and is stored as is
+    uint32_t rawSize;
+};
+#pragma pack(pop)
+
+bool InflateBlock(const char *source, size_t sourceSize, const std::string &preset, char *destination, size_t rawSize)
+{
+    // One inflater per thread, reset between blocks instead of reallocated
+    struct Inflater
+    {
+        z_stream stream = {};
+        bool ready = false;
+        ~Inflater()
+        {
+            if (ready)
+                inflateEnd(&stream);
+        }
+    };
+    thread_local Inflater inflater;
+    z_stream &stream = inflater.stream;
+    if (!inflater.ready)
+    {
+        if (inflateInit2(&stream, -MAX_WBITS) != Z_OK)
+            return false;
+        inflater.ready = true;
+    }
+    else if (inflateReset(&stream) != Z_OK)
+    {
+        return false;
+    }
+    if (!preset.empty() && inflateSetDictionary(&stream, reinterpret_cast<const Bytef *>(preset.data()), preset.size()) != Z_OK)
+        return false;
+
+    stream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(source));
+    stream.avail_in = static_cast<uInt>(sourceSize);
+    stream.next_out = reinterpret_cast<Bytef *>(destination);
+    stream.avail_out = static_cast<uInt>(rawSize);
+    return inflate(&stream, Z_FINISH) == Z_STREAM_END && stream.total_out == rawSize;
+}
+
+// Block table and preset dictionary of a compressed file, read-only once loaded
+class BlockTable
+{
+public:
+    bool Load(const FileReader &file, const BitcaskHeader &header)
+    {
+        static std::atomic<uint64_t> nextId{1};
+        id = nextId++;
+        // Both sections must lie inside the file before their sizes are trusted for allocation
+        uint64_t fileSize = file.Size();
+        if (header.blockTableOffset > fileSize || header.blockCount > (fileSize - header.blockTableOffset) / sizeof(BlockEntry) ||
+            header.presetOffset > fileSize || header.presetSize > fileSize - header.presetOffset)
+            return false;
+        entries.resize(header.blockCount);
+        preset.resize(header.presetSize);
+        return file.ReadAt(header.blockTableOffset, entries.size() * sizeof(BlockEntry), reinterpret_cast<char *>(entries.data())) &&
+               file.ReadAt(header.presetOffset, preset.size(), &preset[0]);
+    }
+
+    uint32_t Count() const { return static_cast<uint32_t>(entries.size()); }
+    const BlockEntry &Entry(uint32_t block) const { return entries[block]; }
+
+    bool ReadBlock(const FileReader &file, uint32_t block, std::vector<char> &raw) const
+    {
+        if (block >= entries.size())
+            return false;
+        const BlockEntry &entry = entries[block];
+        thread_local std::vector<char> scratch;
+        const char *source = file.Fetch(entry.offset, entry.compressedSize, scratch);
+        if (!source)
+            return false;
+        raw.resize(entry.rawSize);
+        if (entry.compressedSize == entry.rawSize)
+        {
+            std::memcpy(raw.data(), source, entry.rawSize);
+            return true;
+        }
+        return InflateBlock(source, entry.compressedSize, preset, raw.data(), entry.rawSize);
+    }
+
+    // Bytes of the record at a block location. The pointer stays valid until this thread fetches
+    // from another block; the last block each thread inflated is kept, so neighbours are cheap.
+    const char *FetchRecord(const FileReader &file, uint64_t location, uint32_t size) const
+    {
+        struct LastBlock
+        {
+            uint64_t owner = 0;
+            uint32_t block = 0;
+            std::vector<char> raw;
+        };
+        thread_local LastBlock last;
+
+        uint32_t block = static_cast<uint32_t>(location >> 32);
+        uint32_t offsetInBlock = static_cast<uint32_t>(location);
+        if (last.owner != id || last.block != block)
+        {
+            last.owner = 0;
+            if (!ReadBlock(file, block, last.raw))
+                return nullptr;
+            last.owner = id;
+            last.block = block;
+        }
+        if (offsetInBlock > last.raw.size() || size > last.raw.size() - offsetInBlock)
+            return nullptr;
+        return last.raw.data() + offsetInBlock;
+    }
+
+private:
+    uint64_t id = 0; // Tells this table's blocks apart in the per-thread cache
+    std::vector<BlockEntry> entries;
+    std::string preset;
+};
+
+// Bytes of the record an index entry points at, decompressing its block if the file has them
+const char *FetchRecord(const FileReader &file, const BitcaskHeader &header, const BlockTable &blocks, uint64_t location, uint32_t size, std::vector<char> &scratch)
+{
+    if (header.HasCompressedBlocks())
+        return blocks.FetchRecord(file, location, size);
+    return file.Fetch(location, size, scratch);
+}
+
+const uint64_t kMinKernelCopy = 64 * 1024;      // Shorter record ranges are read and buffered instead
+const size_t kCopyBufferSize = 1024 * 1024;     // Chunk size when the kernel cannot copy file to file
+const uint64_t kWriteBehindBytes = 64 * 1024 * 1024; // Output written back and dropped from the page cache at once with --direct
+
+// Writes the data section, plain or as compressed blocks, and hands out the location the index
+// records for each appended record. Compressed blocks are held back until the first
+// kPresetTrainingBytes have been seen, so the preset dictionary can be sampled from them.
+class DataSectionWriter
+{
+public:
+    DataSectionWriter(std::ofstream &out, bool compress) : out(out), compress(compress), position(static_cast<uint64_t>(out.tellp())) {}
+    DataSectionWriter(const DataSectionWriter &) = delete;
+    DataSectionWriter &operator=(const DataSectionWriter &) = delete;
+    ~DataSectionWriter()
+    {
+        if (deflaterReady)
+            deflateEnd(&deflater);
+        if (outFd >= 0)
+            close(outFd);
+        if (behindFd >= 0)
+            close(behindFd);
+    }
+
+    // Let AppendFrom copy plain records file to file; path names the file out writes to
+    bool EnableRangeCopy(const std::string &path)
+    {
+        if (!compress)
+            outFd = open(path.c_str(), O_WRONLY);
+        return outFd >= 0;
+    }
+
+    // Write the section back and drop it from the page cache every kWriteBehindBytes, so a large
+    // build or merge does not push the data lookups use out of memory
+    bool EnableWriteBehind(const std::string &path)
+    {
+        behindFd = open(path.c_str(), O_WRONLY);
+        return behindFd >= 0;
+    }
+
+    bool CanCopyRanges() const { return outFd >= 0; }
+
+    // Append the record stored at offset in sourceFd without reading it into memory, returning
+    // its location. A record that continues the previous one extends the same copy, so a long
+    // run from one input goes out as a single kernel copy.
+    uint64_t AppendFrom(int sourceFd, uint64_t offset, size_t size)
+    {
+        metrics.Add(Counter::RecordsWritten);
+        if (sourceFd != copyFd || offset != copyStart + copySize)
+        {
+            FlushCopy();
+            copyFd = sourceFd;
+            copyStart = offset;
+        }
+        uint64_t location = position;
+        copySize += size;
+        position += size;
+        WriteBehind(position, false);
+        return location;
+    }
+
+    uint64_t Append(const char *record, size_t size)
+    {
+        metrics.Add(Counter::RecordsWritten);
+        if (!compress)
+        {
+            FlushCopy();
+            uint64_t offset = position;
+            out.write(record, size);
+            position += size;
+            WriteBehind(position, false);
+            return offset;
+        }
+
+        if (!current.empty() && current.size() + size > kCompressedBlockSize)
+            CloseBlock();
+        uint64_t location = BlockLocation(static_cast<uint32_t>(blocks.size() + pending.size()), static_cast<uint32_t>(current.size()));
+        current.append(record, size);
+        return location;
+    }
+
+    // Append records serialized back to back, with one large write when uncompressed. Each
+    // entry's offset into records is replaced with the record's location in the data section.
+    void AppendRun(const std::string &records, std::vector<std::tuple<std::string, uint64_t, uint32_t>> &entries)
+    {
+        if (compress)
+        {
+            for (auto &entry : entries)
+                std::get<1>(entry) = Append(records.data() + std::get<1>(entry), std::get<2>(entry));
+            return;
+        }
+        metrics.Add(Counter::RecordsWritten, entries.size());
+        FlushCopy();
+        uint64_t base = position;
+        out.write(records.data(), records.size());
+        position += records.size();
+        for (auto &entry : entries)
+            std::get<1>(entry) += base;
+        WriteBehind(position, false);
+    }
+
+    // Write out the last block; call once every record has been appended
+    bool Finish()
+    {
+        if (!compress)
+        {
+            bool flushed = FlushCopy() && !copyFailed;
+            WriteBehind(position, true);
+            return flushed;
+        }
+        if (!current.empty())
+            CloseBlock();
+        if (!trained)
+            Train();
+        bool written = WritePending();
+        WriteBehind(static_cast<uint64_t>(out.tellp()), true);
+        return written;
+    }
+
+    // Write the block table and preset dictionary after the index and record them in the header
+    void WriteBlockTable(BitcaskHeader &header)
+    {
+        if (!compress)
+            return;
+        header.compression = kCompressionDeflate;
+        header.blockCount = static_cast<uint32_t>(blocks.size());
+        header.blockTableOffset = static_cast<uint64_t>(out.tellp());
+        out.write(reinterpret_cast<const char *>(blocks.data()), blocks.size() * sizeof(BlockEntry));
+        header.presetOffset = static_cast<uint64_t>(out.tellp());
+        header.presetSize = static_cast<uint32_t>(preset.size());
+        out.write(preset.data(), preset.size());
+    }
+
+    uint64_t RawBytes() const { return rawBytes; }
+
+private:
+    // Write out the pending range. Short ones are read and go through out's buffer; long ones
+    // are copied by the kernel straight into the file, and out is moved past them.
+    bool FlushCopy()
+    {
+        if (copySize == 0)
+            return true;
+        uint64_t target = position - copySize;
+        bool copied;
+        if (copySize < kMinKernelCopy)
+        {
+            copyBuffer.resize(copySize);
+            copied = ReadFully(copyFd, copyBuffer.data(), copySize, copyStart);
+            out.write(copyBuffer.data(), copySize);
+        }
+        else
+        {
+            out.flush();
+            copied = CopyRange(copyFd, copyStart, target, copySize);
+            out.seekp(position);
+        }
+        if (!copied)
+        {
+            std::cerr << "Failed to copy " << copySize << " bytes of records: " << std::strerror(errno) << std::endl;
+            copyFailed = true;
+        }
+        copySize = 0;
+        return copied;
+    }
+
+    static bool ReadFully(int fd, char *destination, size_t size, uint64_t offset)
+    {
+        metrics.Add(Counter::BytesRead, size);
+        return PreadFully(fd, destination, size, offset);
+    }
+
+    // copy_file_range can share extents on reflink filesystems and never leaves the kernel. It
+    // fails across filesystems on older kernels, so sendfile comes next, and then plain reads
+    // and writes. Whichever method worked last is tried first for the next range.
+    bool CopyRange(int sourceFd, uint64_t sourceOffset, uint64_t targetOffset, uint64_t size)
+    {
+        while (size > 0)
+        {
+            ssize_t n;
+            if (copyMethod == CopyMethod::CopyFileRange)
+            {
+                loff_t in = static_cast<loff_t>(sourceOffset), to = static_cast<loff_t>(targetOffset);
+                n = copy_file_range(sourceFd, &in, outFd, &to, size, 0);
+                if (n < 0 && (errno == EXDEV || errno == ENOSYS || errno == EOPNOTSUPP || errno == EINVAL))
+                {
+                    copyMethod = CopyMethod::Sendfile;
+                    continue;
+                }
+            }
+            else if (copyMethod == CopyMethod::Sendfile)
+            {
+                off_t in = static_cast<off_t>(sourceOffset);
+                n = lseek(outFd, static_cast<off_t>(targetOffset), SEEK_SET) < 0 ? -1 : sendfile(outFd, sourceFd, &in, size);
+                if (n < 0 && (errno == EINVAL || errno == ENOSYS))
+                {
+                    copyMethod = CopyMethod::ReadWrite;
+                    continue;
+                }
+            }
+            else
+            {
+                copyBuffer.resize(kCopyBufferSize);
+                n = pread(sourceFd, copyBuffer.data(), std::min<uint64_t>(size, copyBuffer.size()), static_cast<off_t>(sourceOffset));
+                if (n > 0)
+                    n = pwrite(outFd, copyBuffer.data(), static_cast<size_t>(n), static_cast<off_t>(targetOffset));
+            }
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                return false;
+            sourceOffset += static_cast<uint64_t>(n);
+            targetOffset += static_cast<uint64_t>(n);
+            size -= static_cast<uint64_t>(n);
+        }
+        return true;
+    }
+
+    void CloseBlock()
+    {
+        rawBytes += current.size();
+        pendingBytes += current.size();
+        pending.push_back(std::move(current));
+        current.clear();
+        if (!trained && pendingBytes >= kPresetTrainingBytes)
+            Train();
+        if (trained)
+            WritePending();
+    }
+
+    // Sample words and meanings of records spread evenly over the held-back blocks
+    void Train()
+    {
+        trained = true;
+        size_t stride = std::max<size_t>(1, pendingBytes / kPresetDictionarySize);
+        size_t skipped = stride;
+        for (const auto &block : pending)
+        {
+            RecordView record;
+            for (size_t pos = 0; preset.size() < kPresetDictionarySize && ParseRecord(block.data() + pos, block.size() - pos, record);)
+            {
+                size_t recordSize = 3 * sizeof(uint32_t) + record.word.size() + record.meaning.size();
+                skipped += recordSize;
+                if (skipped >= stride)
+                {
+                    skipped = 0;
+                    preset.append(record.word);
+                    preset.append(record.meaning);
+                }
+                pos += recordSize;
+            }
+        }
+        if (preset.size() > kPresetDictionarySize)
+            preset.resize(kPresetDictionarySize);
+    }
+
+    bool WritePending()
+    {
+        if (!deflaterReady)
+        {
+            if (deflateInit2(&deflater, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+                return false;
+            deflaterReady = true;
+        }
+
+        for (const auto &block : pending)
+        {
+            deflateReset(&deflater);
+            if (!preset.empty())
+                deflateSetDictionary(&deflater, reinterpret_cast<const Bytef *>(preset.data()), preset.size());
+            compressed.resize(deflateBound(&deflater, block.size()));
+            deflater.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(block.data()));
+            deflater.avail_in = static_cast<uInt>(block.size());
+            deflater.next_out = reinterpret_cast<Bytef *>(compressed.data());
+            deflater.avail_out = static_cast<uInt>(compressed.size());
+            if (deflate(&deflater, Z_FINISH) != Z_STREAM_END)
+                return false;
+
+            BlockEntry entry = {static_cast<uint64_t>(out.tellp()), static_cast<uint32_t>(deflater.total_out), static_cast<uint32_t>(block.size())};
+            if (entry.compressedSize >= entry.rawSize)
+            {
+                entry.compressedSize = entry.rawSize; // Store blocks that do not shrink as they are
+                out.write(block.data(), block.size());
+            }
+            else
+            {
+                out.write(compressed.data(), entry.compressedSize);
+            }
+            blocks.push_back(entry);
+        }
+        pending.clear();
+        pendingBytes = 0;
+        if (behindFd >= 0)
+            WriteBehind(static_cast<uint64_t>(out.tellp()), false);
+        return static_cast<bool>(out);
+    }
+
+    // Write back and drop everything before end once a full stretch is pending, or all of it
+    void WriteBehind(uint64_t end, bool all)
+    {
+        if (behindFd < 0 || end <= writtenBehind || (!all && end - writtenBehind < kWriteBehindBytes))
+            return;
+        FlushCopy();
+        out.flush();
+        off_t start = static_cast<off_t>(writtenBehind), length = static_cast<off_t>(end - writtenBehind);
+        sync_file_range(behindFd, start, length, SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+        posix_fadvise(behindFd, start, length, POSIX_FADV_DONTNEED);
+        writtenBehind = end;
+    }
+
+    std::ofstream &out;
+    bool compress;
+    uint64_t position;                // Where the next plain record goes; asking out costs a seek per record
+    int outFd = -1;                   // The output again, for kernel copies
+    int behindFd = -1;                // The output again, for write-behind
+    uint64_t writtenBehind = 0;       // Output before this offset is written back and dropped
+    int copyFd = -1;                  // Source of the pending range
+    uint64_t copyStart = 0, copySize = 0;
+    bool copyFailed = false;
+    enum class CopyMethod { CopyFileRange, Sendfile, ReadWrite } copyMethod = CopyMethod::CopyFileRange;
+    std::vector<char> copyBuffer;
+    std::string current;              // Block being filled
+    std::vector<std::string> pending; // Closed blocks not yet compressed
+    size_t pendingBytes = 0;
+    uint64_t rawBytes = 0;
+    bool trained = false;
+    std::string preset;
+    std::vector<BlockEntry> blocks;
+    z_stream deflater = {};
+    bool deflaterReady = false;
+    std::vector<char> compressed;
+};
+
+// Append a record in the format [checksum][wordSize][meaningSize][word][meaning] to out,
+// returning its block size
+uint32_t SerializeRecord(std::string &out, std::string_view word, std::string_view meaning)
+{
+    uint32_t wordSize = word.size();
+    uint32_t meaningSize = meaning.size();
+    uint32_t checksum = RecordChecksum(wordSize, meaningSize, word, meaning);
+
+    out.append(reinterpret_cast<const char *>(&checksum), sizeof(checksum));
+    BITCASK_LOG(Trace, "Write checksum (" << checksum << ") for word: '" << word << "', size: " << sizeof(checksum) << " bytes");
+
+    out.append(reinterpret_cast<const char *>(&wordSize), sizeof(wordSize));
+    BITCASK_LOG(Trace, "Write word size (" << wordSize << ") for word: '" << word << "', size: " << sizeof(wordSize) << " bytes");
+
+    out.append(reinterpret_cast<const char *>(&meaningSize), sizeof(meaningSize));
+    BITCASK_LOG(Trace, "Write meaning size (" << meaningSize << ") for word: '" << word << "', size: " << sizeof(meaningSize) << " bytes");
+
+    out.append(word);
+    BITCASK_LOG(Trace, "Write word: '" << word << "', size: " << wordSize << " bytes");
+
+    out.append(meaning);
+
+    // Return the total size of the block written
+    return sizeof(checksum) + sizeof(wordSize) + sizeof(meaningSize) + wordSize + meaningSize;
+}
+
+// Helper function to write a Bitcask entry, returning its block size and where it was written
+uint32_t WriteBitcaskEntry(DataSectionWriter &out, const std::string &word, const std::string &meaning, uint64_t &location)
+{
+    thread_local std::string record;
+    record.clear();
+    uint32_t blockSize = SerializeRecord(record, word, meaning);
+    location = out.Append(record.data(), record.size());
+    return blockSize;
+}
+
+// Spread the fences so the table stays small enough to load with a single read. Fences sit on
+// restart points, so a run between two fences can be decoded on its own.
+uint32_t ChooseFenceInterval(uint32_t entryCount)
+{
+    uint32_t interval = (entryCount + kMaxFenceCount - 1) / kMaxFenceCount;
+    interval = (interval + kRestartInterval - 1) / kRestartInterval * kRestartInterval;
+    return std::max(interval, kMinFenceInterval);
+}
+
+void AppendVarint(std::string &out, uint64_t value)
+{
+    while (value >= 0x80)
+    {
+        out.push_back(static_cast<char>(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<char>(value));
+}
+
+bool ReadVarint(const char *data, size_t size, size_t &pos, uint64_t &value)
+{
+    value = 0;
+    for (int shift = 0; shift < 64 && pos < size; shift += 7)
+    {
+        uint8_t byte = static_cast<uint8_t>(data[pos++]);
+        value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+        if (!(byte & 0x80))
+            return true;
+    }
+    return false;
+}
+
+// Decodes index entries in key order, starting from a restart point. Front-coded entries
+// (format 5) are [shared][unshared][offset delta][blockSize][unshared key bytes], all varints
+// but the key bytes: the key reuses `shared` bytes of the previous key, and the offset is stored
+// zigzag-encoded relative to the end of the previous entry's record, which is 0 after a merge.
+// Every restartInterval-th entry restarts with a full key and an absolute offset. Older files
+// use fixed-width [wordSize][word][offset][blockSize] entries, decoded as if every entry restarts.
+class IndexDecoder
+{
+public:
+    explicit IndexDecoder(const BitcaskHeader &header) : frontCoded(header.HasFrontCodedIndex()), interval(header.RestartInterval()) {}
+
+    // Forget the previous entry; the next entry decoded must be a restart point
+    void Restart()
+    {
+        key.clear();
+        previousEnd = 0;
+        sinceRestart = 0;
+    }
+
+    // Decode the entry at data + pos, moving pos past it. Returns false, leaving the decoder
+    // untouched, if the entry does not fit in size.
+    bool Next(const char *data, size_t size, size_t &pos)
+    {
+        if (!frontCoded)
+        {
+            uint32_t wordSize;
+            if (pos + sizeof(wordSize) > size)
+                return false;
+            std::memcpy(&wordSize, data + pos, sizeof(wordSize));
+            if (pos + sizeof(wordSize) + wordSize + sizeof(dataOffset) + sizeof(blockSize) > size)
+                return false;
+            key.assign(data + pos + sizeof(wordSize), wordSize);
+            std::memcpy(&dataOffset, data + pos + sizeof(wordSize) + wordSize, sizeof(dataOffset));
+            std::memcpy(&blockSize, data + pos + sizeof(wordSize) + wordSize + sizeof(dataOffset), sizeof(blockSize));
+            pos += sizeof(wordSize) + wordSize + sizeof(dataOffset) + sizeof(blockSize);
+            return true;
+        }
+
+        bool restart = sinceRestart == interval || sinceRestart == 0;
+        uint64_t shared, unshared, delta, size64;
+        size_t p = pos;
+        if (!ReadVarint(data, size, p, shared) || !ReadVarint(data, size, p, unshared) ||
+            !ReadVarint(data, size, p, delta) || !ReadVarint(data, size, p, size64) || unshared > size - p)
+            return false;
+        if (shared > (restart ? 0 : key.size()))
+            return false;
+        if (restart)
+            Restart();
+
+        key.resize(shared);
+        key.append(data + p, unshared);
+        int64_t signedDelta = static_cast<int64_t>(delta >> 1) ^ -static_cast<int64_t>(delta & 1);
+        dataOffset = previousEnd + static_cast<uint64_t>(signedDelta);
+        blockSize = static_cast<uint32_t>(size64);
+        previousEnd = dataOffset + blockSize;
+        sinceRestart++;
+        pos = p + unshared;
+        return true;
+    }
+
+    const std::string &Key() const { return key; }
+    uint64_t DataOffset() const { return dataOffset; }
+    uint32_t BlockSize() const { return blockSize; }
+
+private:
+    bool frontCoded;
+    uint32_t interval;
+    uint32_t sinceRestart = 0;
+    std::string key;
+    uint64_t previousEnd = 0;
+    uint64_t dataOffset = 0;
+    uint32_t blockSize = 0;
+};
+
+// Full key of the restart entry at data, read in place
+bool RestartKey(const BitcaskHeader &header, const char *data, size_t size, std::string_view &key)
+{
+    size_t pos = 0;
+    if (!header.HasFrontCodedIndex())
+    {
+        uint32_t wordSize;
+        if (size < sizeof(wordSize))
+            return false;
+        std::memcpy(&wordSize, data, sizeof(wordSize));
+        if (size - sizeof(wordSize) < wordSize)
+            return false;
+        key = std::string_view(data + sizeof(wordSize), wordSize);
+        return true;
+    }
+    uint64_t shared, unshared, delta, blockSize;
+    if (!ReadVarint(data, size, pos, shared) || !ReadVarint(data, size, pos, unshared) ||
+        !ReadVarint(data, size, pos, delta) || !ReadVarint(data, size, pos, blockSize) || unshared > size - pos)
+        return false;
+    key = std::string_view(data + pos, unshared);
+    return true;
+}
+
+const size_t kIndexWriteBuffer = 1024 * 1024; // Encoded index bytes held before they are written out
+const size_t kIndexReadAhead = 1024 * 1024;   // Bytes of index read per refill
+
+// Entries of an index section, read in order through a read-ahead buffer
+class IndexStream
+{
+public:
+    explicit IndexStream(size_t readAhead = kIndexReadAhead) : readAhead(readAhead) {}
+
+    bool Open(const std::string &path, const BitcaskHeader &header)
+    {
+        if (file.is_open())
+            file.close();
+        file.open(path, std::ios::binary);
+        file.seekg(header.indexOffset);
+        decoder.emplace(header);
+        remaining = header.entryCount;
+        buffer.clear();
+        bufferPos = 0;
+        bufferStart = header.indexOffset;
+        return static_cast<bool>(file);
+    }
+
+    bool Next()
+    {
+        // Only entryCount entries belong to the index; the fence and slots tables follow them
+        if (remaining == 0)
+            return false;
+        remaining--;
+
+        while (true)
+        {
+            size_t start = bufferPos;
+            if (decoder->Next(buffer.data(), buffer.size(), bufferPos))
+            {
+                entryOffset = bufferStart + start;
+                return true;
+            }
+            if (!Refill())
+                return false;
+        }
+    }
+
+    const std::string &Key() const { return decoder->Key(); }
+    uint64_t EntryOffset() const { return entryOffset; }
+    uint64_t DataOffset() const { return decoder->DataOffset(); }
+    uint32_t BlockSize() const { return decoder->BlockSize(); }
+
+private:
+    // Keep the partly read entry at the front of the buffer and append the next chunk after it
+    bool Refill()
+    {
+        buffer.erase(buffer.begin(), buffer.begin() + bufferPos);
+        bufferStart += bufferPos;
+        bufferPos = 0;
+        size_t kept = buffer.size();
+        buffer.resize(kept + readAhead);
+        file.read(buffer.data() + kept, readAhead);
+        buffer.resize(kept + static_cast<size_t>(file.gcount()));
+        metrics.Add(Counter::ReadCalls);
+        metrics.Add(Counter::BytesRead, buffer.size() - kept);
+        return buffer.size() > kept;
+    }
+
+    size_t readAhead;
+    std::ifstream file;
+    uint32_t remaining = 0;
+    std::vector<char> buffer;
+    size_t bufferPos = 0;
+    uint64_t bufferStart = 0; // File offset of buffer[0]
+    uint64_t entryOffset = 0; // File offset of the current entry
+    std::optional<IndexDecoder> decoder; // Created once the header says how the index is encoded
+};
+
+// Writes an index section from entries added in word order: the front-coded entries, then the
+// fence table ([wordSize][word][entryOffset] for every fenceInterval-th entry) and the restart
+// table (one uint64_t entry offset per restart point), and points the header at all three.
+// Entries go out as they are added and nothing is kept per entry: the fence interval depends on
+// the final entry count, so both tables are rebuilt by reading the entries back.
+class IndexSectionWriter
+{
+public:
+    IndexSectionWriter(std::ofstream &out, BitcaskHeader &header) : out(&out), header(header)
+    {
+        header.indexOffset = out.tellp();
+        header.entryCount = 0;
+        header.formatVersion = kCurrentFormatVersion;
+        header.restartInterval = kRestartInterval;
+    }
+
+    void Add(std::string_view word, uint64_t offset, uint32_t blockSize)
+    {
+        size_t shared = 0;
+        if (header.entryCount % kRestartInterval == 0)
+        {
+            previousEnd = 0;
+        }
+        else
+        {
+            size_t limit = std::min(previousKey.size(), word.size());
+            while (shared < limit && previousKey[shared] == word[shared])
+                shared++;
+        }
+
+        int64_t delta = static_cast<int64_t>(offset - previousEnd);
+        AppendVarint(encoded, shared);
+        AppendVarint(encoded, word.size() - shared);
+        AppendVarint(encoded, (static_cast<uint64_t>(delta) << 1) ^ static_cast<uint64_t>(delta >> 63));
+        AppendVarint(encoded, blockSize);
+        encoded.append(word.substr(shared));
+        BITCASK_LOG(Trace, "Index entry for word: '" << word << "', offset: " << offset << ", block size: " << blockSize);
+
+        previousKey.assign(word);
+        previousEnd = offset + blockSize;
+        header.entryCount++;
+        if (encoded.size() >= kIndexWriteBuffer)
+            FlushEntries();
+    }
+
+    // Write out the entries added so far
+    void FlushEntries()
+    {
+        out->write(encoded.data(), encoded.size());
+        written += encoded.size();
+        encoded.clear();
+    }
+
+    // Copy the entries, written so far to a spill file at spillPath, to the end of destination,
+    // which then takes the rest of the section. Lets the index be built while records are
+    // still being appended to destination.
+    bool MoveEntriesTo(std::ofstream &destination, const std::string &spillPath)
+    {
+        FlushEntries();
+        out->flush();
+        std::ifstream spill(spillPath, std::ios::binary);
+        spill.seekg(header.indexOffset);
+        header.indexOffset = destination.tellp();
+        std::vector<char> buffer(kIndexWriteBuffer);
+        for (uint64_t left = written; left > 0;)
+        {
+            size_t size = static_cast<size_t>(std::min<uint64_t>(left, buffer.size()));
+            if (!spill.read(buffer.data(), size))
+                return false;
+            destination.write(buffer.data(), size);
+            left -= size;
+        }
+        out = &destination;
+        return static_cast<bool>(destination);
+    }
+
+    // Write the fence and restart tables after the entries; path names the file out writes to
+    bool Finish(const std::string &path)
+    {
+        FlushEntries();
+        out->flush();
+        header.fenceInterval = ChooseFenceInterval(header.entryCount);
+        header.fenceOffset = out->tellp();
+        header.fenceCount = 0;
+
+        // One pass for the fences, which come first, and one for the restart points
+        IndexStream entries;
+        if (!entries.Open(path, header))
+            return false;
+        for (uint32_t i = 0; entries.Next(); ++i)
+        {
+            if (i % header.fenceInterval != 0)
+                continue;
+            uint32_t wordSize = entries.Key().size();
+            uint64_t entryOffset = entries.EntryOffset();
+            out->write(reinterpret_cast<const char *>(&wordSize), sizeof(wordSize));
+            out->write(entries.Key().data(), wordSize);
+            out->write(reinterpret_cast<const char *>(&entryOffset), sizeof(entryOffset));
+            header.fenceCount++;
+        }
+
+        header.slotsOffset = out->tellp();
+        std::vector<uint64_t> restarts;
+        if (!entries.Open(path, header))
+            return false;
+        for (uint32_t i = 0; entries.Next(); ++i)
+        {
+            if (i % kRestartInterval == 0)
+                restarts.push_back(entries.EntryOffset());
+            if (restarts.size() == kIndexWriteBuffer / sizeof(uint64_t))
+            {
+                out->write(reinterpret_cast<const char *>(restarts.data()), restarts.size() * sizeof(uint64_t));
+                restarts.clear();
+            }
+        }
+        out->write(reinterpret_cast<const char *>(restarts.data()), restarts.size() * sizeof(uint64_t));
+
+        BITCASK_LOG(Info, "Index written with " << header.entryCount << " entries (" << written << " bytes), "
+                          << header.fenceCount << " fences every " << header.fenceInterval << " entries");
+        return static_cast<bool>(*out);
+    }
+
+private:
+    std::ofstream *out;
+    BitcaskHeader &header;
+    std::string encoded;
+    uint64_t written = 0; // Encoded bytes already passed to out
+    std::string previousKey;
+    uint64_t previousEnd = 0;
+};
+
+// 64-bit FNV-1a, stable across builds so hashes can be stored on disk
+uint64_t HashWord(std::string_view word)
+{
+    uint64_t hash = 1469598103934665603ULL;
+    for (unsigned char c : word)
+    {
+        hash ^= c;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+// The Bloom filter is blocked: each word sets all its bits inside one 64-byte block, so a query
+// costs one cache line in place, and misses are answered without touching the index.
+const size_t kFilterBlockBytes = 64;
+const uint32_t kFilterBlockBits = kFilterBlockBytes * 8;
+
+// HashWord with a final avalanche, since the block and the bit positions use different halves
+uint64_t FilterHash(std::string_view word)
+{
+    uint64_t hash = HashWord(word);
+    hash ^= hash >> 33;
+    hash *= 0xFF51AFD7ED558CCDULL;
+    hash ^= hash >> 33;
+    hash *= 0xC4CEB9FE1A85EC53ULL;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+// Bits of the word's block, drawn from the top of a 64-bit LCG seeded with the hash. Plain double
+// hashing inside a 512-bit block repeats patterns often enough to miss the target rate.
+template <typename BitVisitor>
+void ForEachFilterBit(uint64_t hash, uint32_t blockCount, uint32_t probes, BitVisitor visit)
+{
+    uint64_t blockStart = ((hash >> 32) * blockCount >> 32) * kFilterBlockBits;
+    uint64_t state = hash;
+    for (uint32_t i = 0; i < probes; ++i)
+    {
+        state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+        visit(blockStart + (state >> 55));
+    }
+}
+
+// False-positive rate of a blocked filter at bitsPerKey: block loads vary (Poisson around the
+// mean), and crowded blocks dominate, so it is summed over loads rather than taken at the mean
+double BlockedFilterRate(double bitsPerKey, uint32_t probes)
+{
+    double meanLoad = kFilterBlockBits / bitsPerKey;
+    double weight = std::exp(-meanLoad), rate = 0;
+    for (uint32_t load = 0; load < meanLoad * 4 + 64; ++load)
+    {
+        rate += weight * std::pow(1 - std::pow(1 - 1.0 / kFilterBlockBits, static_cast<double>(load) * probes), probes);
+        weight *= meanLoad / (load + 1);
+    }
+    return rate;
+}
+
+// Size the filter for keyCount words at the given false-positive rate, or leave it empty
+void ChooseFilterShape(uint32_t keyCount, double falsePositiveRate, uint32_t &blockCount, uint32_t &probes)
+{
+    blockCount = probes = 0;
+    if (keyCount == 0 || falsePositiveRate <= 0 || falsePositiveRate >= 1)
+        return;
+
+    // Start from the classic size and grow it until the blocked layout meets the rate
+    double bitsPerKey = std::max(1.0, -std::log(falsePositiveRate) / (std::log(2.0) * std::log(2.0)));
+    for (;; bitsPerKey += 0.25)
+    {
+        probes = static_cast<uint32_t>(std::clamp(std::lround(bitsPerKey * std::log(2.0)), 1L, 16L));
+        if (BlockedFilterRate(bitsPerKey, probes) <= falsePositiveRate || bitsPerKey >= 64)
+            break;
+    }
+    blockCount = static_cast<uint32_t>(std::max(1.0, std::ceil(keyCount * bitsPerKey / kFilterBlockBits)));
+}
+
+bool FilterMayContain(const char *filter, uint32_t blockCount, uint32_t probes, std::string_view word)
+{
+    bool present = true;
+    ForEachFilterBit(FilterHash(word), blockCount, probes, [&](uint64_t bit) {
+        present = present && (static_cast<uint8_t>(filter[bit / 8]) >> (bit % 8) & 1);
+    });
+    return present;
+}
+
+// Write the Bloom filter over the words of the index section just written to path, and point
+// the header at it
+void WriteFilterSection(std::ofstream &out, const std::string &path, BitcaskHeader &header)
+{
+    ChooseFilterShape(header.entryCount, filterFalsePositiveRate, header.filterBlocks, header.filterProbes);
+    header.filterOffset = 0;
+    IndexStream index;
+    if (header.filterBlocks == 0 || !index.Open(path, header))
+    {
+        header.filterBlocks = 0;
+        return;
+    }
+
+    std::vector<char> filter(static_cast<size_t>(header.filterBlocks) * kFilterBlockBytes, 0);
+    while (index.Next())
+    {
+        ForEachFilterBit(FilterHash(index.Key()), header.filterBlocks, header.filterProbes, [&](uint64_t bit) {
+            filter[bit / 8] |= static_cast<char>(1 << (bit % 8));
+        });
+    }
+    header.filterOffset = out.tellp();
+    out.write(filter.data(), filter.size());
+    BITCASK_LOG(Info, "Bloom filter written with " << filter.size() << " bytes, " << header.filterProbes << " probes per word");
+}
+
+// The perfect hash index is a minimal perfect hash function over every word, built like BBHash,
+// followed by a dense slot table. Each level has kPerfectHashGamma bits per word still unplaced;
+// a word whose position at a level no other word hits claims that bit, and the rest move on to
+// the next level. A word's slot is the rank of its bit across all levels, so the function takes
+// about 3.7 bits per word and a lookup is one hash, a bit probe or two and one slot read. A word
+// that is not in the dictionary can land on a set bit too, so a slot only names a candidate
+// record, whose word has to be compared.
+//
+// Section: [levelCount + 1 uint64_t bit offsets where each level starts][bit words][one uint64_t
+// rank sample, the bits set before it, per kRankSampleWords bit words], 8-byte aligned. The slot
+// table is entryCount [location][blockSize] slots.
+const double kPerfectHashGamma = 2.0;
+const uint32_t kMaxPerfectHashLevels = 64;
+const size_t kRankSampleWords = 8;
+const size_t kPerfectHashSlotBytes = sizeof(uint64_t) + sizeof(uint32_t);
+
+// Bit position of a word's hash inside a level of levelBits bits, independent for every level
+uint64_t PerfectHashPosition(uint64_t hash, uint32_t level, uint64_t levelBits)
+{
+    uint64_t mixed = hash + (level + 1) * 0x9E3779B97F4A7C15ULL;
+    mixed ^= mixed >> 33;
+    mixed *= 0xFF51AFD7ED558CCDULL;
+    mixed ^= mixed >> 33;
+    mixed *= 0xC4CEB9FE1A85EC53ULL;
+    mixed ^= mixed >> 33;
+    return static_cast<uint64_t>((static_cast<unsigned __int128>(mixed) * levelBits) >> 64);
+}
+
+// The levels of a perfect hash, in a mapping or loaded; the writer uses it to place the slots
+struct PerfectHashLevels
+{
+    const uint64_t *levelStarts = nullptr;
+    uint32_t levelCount = 0;
+    const uint64_t *bits = nullptr;
+    const uint64_t *ranks = nullptr;
+
+    // Slot of the word with this HashWord, or false when no level places it
+    bool Slot(uint64_t hash, uint64_t &slot) const
+    {
+        for (uint32_t level = 0; level < levelCount; ++level)
+        {
+            uint64_t bit = levelStarts[level] + PerfectHashPosition(hash, level, levelStarts[level + 1] - levelStarts[level]);
+            uint64_t word = bits[bit / 64];
+            if (!(word >> (bit % 64) & 1))
+                continue;
+            uint64_t sample = bit / 64 / kRankSampleWords;
+            slot = ranks[sample] + __builtin_popcountll(word & ((1ULL << (bit % 64)) - 1));
+            for (uint64_t i = sample * kRankSampleWords; i < bit / 64; ++i)
+                slot += __builtin_popcountll(bits[i]);
+            return true;
+        }
+        return false;
+    }
+};
+
+// Write a perfect hash and slot table over the words of the index section just written to path,
+// and point the header at them. The header is left without one if the hash cannot be built.
+void WritePerfectHashSection(std::ofstream &out, const std::string &path, BitcaskHeader &header)
+{
+    header.perfectHashOffset = header.perfectHashSlotsOffset = 0;
+    header.perfectHashLevels = 0;
+    IndexStream index;
+    if (header.entryCount == 0 || !index.Open(path, header))
+        return;
+
+    std::vector<uint64_t> hashes;
+    hashes.reserve(header.entryCount);
+    while (index.Next())
+        hashes.push_back(HashWord(index.Key()));
+
+    // Words whose bit collides at one level are placed by the next
+    std::vector<uint64_t> levelStarts = {0}, bits, collided;
+    while (!hashes.empty())
+    {
+        uint32_t level = static_cast<uint32_t>(levelStarts.size() - 1);
+        if (level == kMaxPerfectHashLevels)
+        {
+            BITCASK_LOG(Warn, "No perfect hash written for " << path << ": " << hashes.size() << " words share their hashes");
+            return;
+        }
+        uint64_t levelBits = (static_cast<uint64_t>(hashes.size() * kPerfectHashGamma) + 63) / 64 * 64;
+        size_t first = bits.size();
+        bits.resize(first + levelBits / 64, 0);
+        collided.assign(levelBits / 64, 0);
+        for (uint64_t hash : hashes)
+        {
+            uint64_t bit = PerfectHashPosition(hash, level, levelBits);
+            uint64_t &word = bits[first + bit / 64];
+            if (word >> (bit % 64) & 1)
+                collided[bit / 64] |= 1ULL << (bit % 64);
+            word |= 1ULL << (bit % 64);
+        }
+        size_t kept = 0;
+        for (uint64_t hash : hashes)
+        {
+            uint64_t bit = PerfectHashPosition(hash, level, levelBits);
+            if (collided[bit / 64] >> (bit % 64) & 1)
+                hashes[kept++] = hash;
+        }
+        hashes.resize(kept);
+        for (size_t i = 0; i < collided.size(); ++i)
+            bits[first + i] &= ~collided[i];
+        levelStarts.push_back(levelStarts.back() + levelBits);
+    }
+
+    std::vector<uint64_t> ranks((bits.size() + kRankSampleWords - 1) / kRankSampleWords);
+    uint64_t setBits = 0;
+    for (size_t i = 0; i < bits.size(); ++i)
+    {
+        if (i % kRankSampleWords == 0)
+            ranks[i / kRankSampleWords] = setBits;
+        setBits += __builtin_popcountll(bits[i]);
+    }
+
+    // Fill each word's slot by reading the index again
+    PerfectHashLevels levels = {levelStarts.data(), static_cast<uint32_t>(levelStarts.size() - 1), bits.data(), ranks.data()};
+    std::vector<char> slots(static_cast<size_t>(header.entryCount) * kPerfectHashSlotBytes);
+    IndexStream slotIndex;
+    bool placed = setBits == header.entryCount && slotIndex.Open(path, header);
+    while (placed && slotIndex.Next())
+    {
+        uint64_t slot, location = slotIndex.DataOffset();
+        uint32_t blockSize = slotIndex.BlockSize();
+        placed = levels.Slot(HashWord(slotIndex.Key()), slot) && slot < header.entryCount;
+        if (placed)
+        {
+            std::memcpy(slots.data() + slot * kPerfectHashSlotBytes, &location, sizeof(location));
+            std::memcpy(slots.data() + slot * kPerfectHashSlotBytes + sizeof(location), &blockSize, sizeof(blockSize));
+        }
+    }
+    if (!placed)
+    {
+        BITCASK_LOG(Warn, "No perfect hash written for " << path << ": its index could not be read back");
+        return;
+    }
+
+    // Aligned, so a mapping can read the levels in place
+    static const char padding[sizeof(uint64_t)] = {};
+    out.write(padding, (sizeof(uint64_t) - static_cast<uint64_t>(out.tellp()) % sizeof(uint64_t)) % sizeof(uint64_t));
+    header.perfectHashOffset = out.tellp();
+    header.perfectHashLevels = levels.levelCount;
+    out.write(reinterpret_cast<const char *>(levelStarts.data()), levelStarts.size() * sizeof(uint64_t));
+    out.write(reinterpret_cast<const char *>(bits.data()), bits.size() * sizeof(uint64_t));
+    out.write(reinterpret_cast<const char *>(ranks.data()), ranks.size() * sizeof(uint64_t));
+    header.perfectHashSlotsOffset = out.tellp();
+    out.write(slots.data(), slots.size());
+    BITCASK_LOG(Info, "Perfect hash written with " << levels.levelCount << " levels, " << (bits.size() + ranks.size()) * sizeof(uint64_t) << " bytes ("
+                      << std::fixed << std::setprecision(2) << (bits.size() + ranks.size()) * 64.0 / header.entryCount << " bits per word) and "
+                      << slots.size() << " bytes of slots");
+}
+
+// The perfect hash of a dictionary file, probed in place. Like a hint file it is always mapped,
+// whatever the read backend, so a lookup reads nothing but the record.
+class PerfectHashIndex
+{
+public:
+    bool Load(const std::string &bitcaskFilePath, const FileReader &file, const BitcaskHeader &header)
+    {
+        data = file.Mapping();
+        uint64_t size = file.Size();
+        if (!data)
+        {
+            if (!mapped.Open(bitcaskFilePath))
+                return false;
+            data = mapped.Data();
+            size = mapped.Size();
+        }
+        entryCount = header.entryCount;
+        slotsOffset = header.perfectHashSlotsOffset;
+
+        uint64_t levelCount = header.perfectHashLevels;
+        uint64_t tableBytes = (levelCount + 1) * sizeof(uint64_t);
+        if (header.perfectHashOffset % sizeof(uint64_t) != 0 || header.perfectHashOffset > slotsOffset ||
+            tableBytes > slotsOffset - header.perfectHashOffset || slotsOffset > size ||
+            static_cast<uint64_t>(entryCount) * kPerfectHashSlotBytes > size - slotsOffset)
+            return false;
+
+        const uint64_t *levelStarts = reinterpret_cast<const uint64_t *>(data + header.perfectHashOffset);
+        for (uint64_t level = 0; level < levelCount; ++level)
+        {
+            if (levelStarts[level + 1] <= levelStarts[level] || levelStarts[level + 1] % 64 != 0)
+                return false;
+        }
+        uint64_t bitWords = levelStarts[levelCount] / 64, rankCount = (bitWords + kRankSampleWords - 1) / kRankSampleWords;
+        if (levelStarts[0] != 0 || bitWords + rankCount > (slotsOffset - header.perfectHashOffset - tableBytes) / sizeof(uint64_t))
+            return false;
+        levels = {levelStarts, static_cast<uint32_t>(levelCount), levelStarts + levelCount + 1, levelStarts + levelCount + 1 + bitWords};
+
+        // The last rank sample and the bits after it must add up to one bit per word
+        uint64_t setBits = rankCount == 0 ? 0 : levels.ranks[rankCount - 1];
+        for (uint64_t i = (rankCount == 0 ? 0 : (rankCount - 1) * kRankSampleWords); i < bitWords; ++i)
+            setBits += __builtin_popcountll(levels.bits[i]);
+        return setBits == entryCount;
+    }
+
+    // Location and block size of the record the word would be in, if it is in the dictionary
+    bool Find(std::string_view word, uint64_t &location, uint32_t &blockSize) const
+    {
+        uint64_t slot;
+        if (!levels.Slot(HashWord(word), slot) || slot >= entryCount)
+            return false;
+        const char *bytes = data + slotsOffset + slot * kPerfectHashSlotBytes;
+        std::memcpy(&location, bytes, sizeof(location));
+        std::memcpy(&blockSize, bytes + sizeof(location), sizeof(blockSize));
+        return true;
+    }
+
+private:
+    MappedFile mapped; // Used when the dictionary's reader has no mapping
+    const char *data = nullptr;
+    uint32_t entryCount = 0;
+    uint64_t slotsOffset = 0;
+    PerfectHashLevels levels;
+};
+
+const uint32_t kHintMagic = 0x544E4948; // "HINT"
+
+// The hint file is a prebuilt open-addressing hash table over the index, written next to the
+// dictionary as <dict>.hint. Fast-read maps it and probes it directly instead of rebuilding
+// inMemoryIndex, so startup cost no longer grows with the number of words.
+#pragma pack(push, 1)
+struct HintHeader
+{
+    uint32_t magic;
+    uint32_t dictVersion;     // Header fields of the dictionary the hint was built from,
+    uint64_t dictIndexOffset; // used to reject a stale hint
+    uint32_t entryCount;
+    uint64_t dictSize;        // Size and modification time of the dictionary file, so one rewritten
+    uint64_t dictMtimeNs;     // with the same version and entry count is not served stale offsets
+    uint64_t bucketCount;     // Power of two, at most half full
+    uint64_t keysOffset;      // Start of the key arena the buckets point into
+};
+
+struct HintBucket
+{
+    uint64_t hash;
+    uint64_t keyOffset;  // Relative to keysOffset
+    uint32_t keySize;
+    uint32_t blockSize;  // Zero marks an empty bucket, records are never empty
+    uint64_t dataOffset;
+};
+#pragma pack(pop)
+
+std::string HintPathFor(const std::string &bitcaskFilePath)
+{
+    return bitcaskFilePath + ".hint";
+}
+
+// Size and modification time a hint records for its dictionary file
+bool DictionaryFileStamp(const std::string &bitcaskFilePath, uint64_t &size, uint64_t &mtimeNs)
+{
+    struct stat st;
+    if (stat(bitcaskFilePath.c_str(), &st) != 0)
+        return false;
+    size = static_cast<uint64_t>(st.st_size);
+    mtimeNs = static_cast<uint64_t>(st.st_mtim.tv_sec) * 1000000000ULL + static_cast<uint64_t>(st.st_mtim.tv_nsec);
+    return true;
+}
+
+// Build the hint file from the index of the finished dictionary. A table larger than the sort
+// memory budget is filled through a shared mapping of the hint file, so it lives in the page
+// cache instead of the heap; smaller ones are built on the heap, which faults far less.
+void WriteHintFile(const std::string &bitcaskFilePath, const BitcaskHeader &header)
+{
+    // Fast-read uses a perfect hash in the dictionary instead, so an old hint is only removed
+    if (header.HasPerfectHash())
+    {
+        std::error_code error;
+        std::filesystem::remove(HintPathFor(bitcaskFilePath), error);
+        return;
+    }
+
+    uint64_t bucketCount = 2;
+    while (bucketCount < static_cast<uint64_t>(header.entryCount) * 2)
+        bucketCount <<= 1;
+
+    HintHeader hintHeader = {kHintMagic, header.version, header.indexOffset, header.entryCount, 0, 0, bucketCount,
+                             sizeof(HintHeader) + bucketCount * sizeof(HintBucket)};
+    if (!DictionaryFileStamp(bitcaskFilePath, hintHeader.dictSize, hintHeader.dictMtimeNs))
+    {
+        std::cerr << "Failed to write hint file " << HintPathFor(bitcaskFilePath) << std::endl;
+        return;
+    }
+
+    std::string hintPath = HintPathFor(bitcaskFilePath);
+    std::vector<char> heapTable;
+    char *table = nullptr;
+    bool mapped = sortMemoryBudget != 0 && hintHeader.keysOffset > sortMemoryBudget;
+    int fd = open(hintPath.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd >= 0 && mapped && ftruncate(fd, static_cast<off_t>(hintHeader.keysOffset)) == 0) // Zero-filled, so every bucket starts empty
+    {
+        void *addr = mmap(nullptr, hintHeader.keysOffset, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        table = addr == MAP_FAILED ? nullptr : static_cast<char *>(addr);
+    }
+    else if (fd >= 0 && !mapped)
+    {
+        heapTable.assign(hintHeader.keysOffset, 0);
+        table = heapTable.data();
+    }
+    if (fd >= 0)
+        close(fd); // A mapping stays valid after the descriptor is closed
+
+    IndexStream index;
+    if (!table || !index.Open(bitcaskFilePath, header))
+    {
+        std::cerr << "Failed to write hint file " << hintPath << std::endl;
+        if (table && mapped)
+            munmap(table, hintHeader.keysOffset);
+        return;
+    }
+
+    std::memcpy(table, &hintHeader, sizeof(hintHeader));
+    HintBucket *buckets = reinterpret_cast<HintBucket *>(table + sizeof(HintHeader));
+    std::ofstream out(hintPath, std::ios::binary | std::ios::in | std::ios::out);
+    out.seekp(hintHeader.keysOffset);
+    uint64_t keysSize = 0;
+    std::string keys;
+    while (index.Next())
+    {
+        const std::string &word = index.Key();
+        uint64_t hash = HashWord(word);
+        uint64_t slot = hash & (bucketCount - 1);
+        while (buckets[slot].blockSize != 0)
+            slot = (slot + 1) & (bucketCount - 1); // Linear probing
+        buckets[slot] = {hash, keysSize + keys.size(), static_cast<uint32_t>(word.size()), index.BlockSize(), index.DataOffset()};
+        keys += word;
+        if (keys.size() >= kIndexWriteBuffer)
+        {
+            out.write(keys.data(), keys.size());
+            keysSize += keys.size();
+            keys.clear();
+        }
+    }
+    out.write(keys.data(), keys.size());
+    if (mapped)
+    {
+        munmap(table, hintHeader.keysOffset);
+    }
+    else
+    {
+        out.seekp(0);
+        out.write(table, heapTable.size());
+    }
+    out.close();
+    if (!out)
+    {
+        std::cerr << "Failed to write hint file " << hintPath << std::endl;
+        return;
+    }
+    BITCASK_LOG(Info, "Hint file written to " << hintPath << " with " << bucketCount << " buckets");
+}
+
+// A mapped hint file, probed in place without rehashing or allocating per key
+class HintIndex
+{
+public:
+    bool Open(const std::string &bitcaskFilePath, const BitcaskHeader &header)
+    {
+        if (!mapped.Open(HintPathFor(bitcaskFilePath)) || mapped.Size() < sizeof(HintHeader))
+            return false;
+
+        std::memcpy(&hintHeader, mapped.Data(), sizeof(hintHeader));
+        uint64_t dictSize = 0, dictMtimeNs = 0;
+        bool valid = hintHeader.magic == kHintMagic &&
+                     hintHeader.dictVersion == header.version &&
+                     hintHeader.dictIndexOffset == header.indexOffset &&
+                     hintHeader.entryCount == header.entryCount &&
+                     DictionaryFileStamp(bitcaskFilePath, dictSize, dictMtimeNs) &&
+                     hintHeader.dictSize == dictSize && hintHeader.dictMtimeNs == dictMtimeNs &&
+                     hintHeader.bucketCount != 0 && (hintHeader.bucketCount & (hintHeader.bucketCount - 1)) == 0 &&
+                     hintHeader.keysOffset == sizeof(HintHeader) + hintHeader.bucketCount * sizeof(HintBucket) &&
+                     hintHeader.keysOffset <= mapped.Size();
+        if (!valid)
+        {
+            std::cerr << "Ignoring stale or corrupt hint file for " << bitcaskFilePath << std::endl;
+            mapped.Close();
+            return false;
+        }
+        return true;
+    }
+
+    bool IsOpen() const { return mapped.Data() != nullptr; }
+    uint32_t EntryCount() const { return hintHeader.entryCount; }
+
+    bool Find(std::string_view word, uint64_t &dataOffset, uint32_t &blockSize) const
+    {
+        uint64_t hash = HashWord(word);
+        uint64_t mask = hintHeader.bucketCount - 1;
+        const char *buckets = mapped.Data() + sizeof(HintHeader);
+        for (uint64_t slot = hash & mask, probes = 0; probes < hintHeader.bucketCount; slot = (slot + 1) & mask, ++probes)
+        {
+            HintBucket bucket;
+            std::memcpy(&bucket, buckets + slot * sizeof(HintBucket), sizeof(bucket));
+            if (bucket.blockSize == 0)
+                return false; // Reached an empty bucket, the word is not in the table
+            if (bucket.hash != hash || bucket.keySize != word.size())
+                continue;
+            uint64_t keyStart = hintHeader.keysOffset + bucket.keyOffset;
+            if (keyStart + bucket.keySize <= mapped.Size() && std::string_view(mapped.Data() + keyStart, bucket.keySize) == word)
+            {
+                dataOffset = bucket.dataOffset;
+                blockSize = bucket.blockSize;
+                return true;
+            }
+        }
+        return false;
+    }
+
+private:
+    MappedFile mapped;
+    HintHeader hintHeader = {};
+};
+
+// Puts and deletes are appended to an active segment, <dict>.active, instead of rewriting the
+// dictionary. Segment records use the data record layout; a delete is a tombstone record whose
+// meaningSize is kTombstone and which carries no meaning bytes. The latest record for a word
+// wins over older segment records and over the dictionary itself, until --compact folds the
+// segment into a new dictionary version.
+const uint32_t kTombstone = UINT32_MAX;
+
+enum class SyncPolicy
+{
+    Always,   // fdatasync after every append
+    Interval, // fdatasync when the last sync is older than the interval, and on close
+    Never     // Leave flushing to the kernel
+};
+
+struct SyncOptions
+{
+    SyncPolicy policy = SyncPolicy::Interval;
+    std::chrono::milliseconds interval{1000};
+};
+
+// Parse a whole non-negative decimal number no larger than max; false on anything else
+bool ParseCount(std::string_view value, uint64_t max, uint64_t &count)
+{
+    uint64_t parsed = 0;
+    auto [end, error] = std::from_chars(value.data(), value.data() + value.size(), parsed);
+    if (value.empty() || error != std::errc() || end != value.data() + value.size() || parsed > max)
+        return false;
+    count = parsed;
+    return true;
+}
+
+// Accepts "always", "never" or an interval such as "250ms"
+bool ParseSyncOptions(const std::string &value, SyncOptions &options)
+{
+    if (value == "always" || value == "never")
+    {
+        options.policy = (value == "always") ? SyncPolicy::Always : SyncPolicy::Never;
+        return true;
+    }
+    uint64_t intervalMs;
+    if (value.size() > 2 && value.compare(value.size() - 2, 2, "ms") == 0 &&
+        ParseCount(std::string_view(value).substr(0, value.size() - 2), INT64_MAX, intervalMs))
+    {
+        options.policy = SyncPolicy::Interval;
+        options.interval = std::chrono::milliseconds(static_cast<int64_t>(intervalMs));
+        return true;
+    }
+    return false;
+}
+
+std::string ActiveSegmentPathFor(const std::string &bitcaskFilePath)
+{
+    return bitcaskFilePath + ".active";
+}
+
+class ActiveSegment
+{
+public:
+    enum class State
+    {
+        Absent, // No record for the word, the dictionary decides
+        Live,
+        Deleted
+    };
+
+    struct Entry
+    {
+        uint64_t meaningOffset; // Into the segment contents
+        uint32_t meaningSize;
+        bool deleted;
+    };
+
+    ActiveSegment() = default;
+    ActiveSegment(const ActiveSegment &) = delete;
+    ActiveSegment &operator=(const ActiveSegment &) = delete;
+    ~ActiveSegment() { Close(); }
+
+    // Read the segment of a dictionary and build its keydir. A missing segment is empty. Reading
+    // stops at the first torn or corrupt record, which is what a crash mid-append leaves behind.
+    bool Load(const std::string &bitcaskFilePath)
+    {
+        path = ActiveSegmentPathFor(bitcaskFilePath);
+        contents.clear();
+        keydir.clear();
+
+        std::ifstream in(path, std::ios::binary);
+        if (!in.is_open())
+            return true;
+        contents.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+
+        uint64_t pos = 0;
+        while (pos < contents.size())
+        {
+            uint64_t recordSize = IndexRecord(pos);
+            if (recordSize == 0)
+            {
+                std::cerr << "Ignoring " << contents.size() - pos << " bytes of torn records at the end of " << path << std::endl;
+                contents.resize(pos);
+                break;
+            }
+            pos += recordSize;
+        }
+        return true;
+    }
+
+    // Take the segment's exclusive lock, held until Close, and load it under the lock. Writers and
+    // --compact all go through here, so none of them sees a record another is still appending.
+    bool LockAndLoad(const std::string &bitcaskFilePath)
+    {
+        std::string segmentPath = ActiveSegmentPathFor(bitcaskFilePath);
+        while (true)
+        {
+            fd = open(segmentPath.c_str(), O_WRONLY | O_CREAT, 0644);
+            int locked = -1;
+            while (fd >= 0 && (locked = flock(fd, LOCK_EX)) != 0 && errno == EINTR)
+            {
+            }
+            struct stat opened, current;
+            if (fd < 0 || locked != 0 || fstat(fd, &opened) != 0)
+            {
+                std::cerr << "Failed to lock active segment " << segmentPath << ": " << std::strerror(errno) << std::endl;
+                if (fd >= 0)
+                    close(fd);
+                fd = -1;
+                return false;
+            }
+            // A compaction may have removed the file while this waited; lock the one now in its place
+            if (stat(segmentPath.c_str(), &current) == 0 && current.st_ino == opened.st_ino && current.st_dev == opened.st_dev)
+                break;
+            close(fd);
+        }
+        return Load(bitcaskFilePath);
+    }
+
+    bool OpenForAppend(const std::string &bitcaskFilePath, const SyncOptions &options)
+    {
+        sync = options;
+        if (!LockAndLoad(bitcaskFilePath))
+            return false;
+        // Drop a torn tail so new records follow the last complete one. Only the lock holder
+        // truncates, so the tail is a crashed append and never one still in progress.
+        if (ftruncate(fd, static_cast<off_t>(contents.size())) != 0 || lseek(fd, 0, SEEK_END) < 0)
+        {
+            std::cerr << "Failed to prepare active segment " << path << ": " << std::strerror(errno) << std::endl;
+            Close();
+            return false;
+        }
+        lastSync = std::chrono::steady_clock::now();
+        return true;
+    }
+
+    bool Put(const std::string &word, const std::string &meaning) { return Append(word, meaning, false); }
+    bool Delete(const std::string &word) { return Append(word, std::string(), true); }
+
+    void Close()
+    {
+        if (fd < 0)
+            return;
+        if (sync.policy == SyncPolicy::Interval)
+            fdatasync(fd);
+        close(fd);
+        fd = -1;
+    }
+
+    State Find(std::string_view word, std::string_view &meaning) const
+    {
+        auto it = keydir.find(word);
+        if (it == keydir.end())
+            return State::Absent;
+        if (it->second.deleted)
+            return State::Deleted;
+        meaning = std::string_view(contents.data() + it->second.meaningOffset, it->second.meaningSize);
+        return State::Live;
+    }
+
+    // Latest record per word, in key order
+    const std::map<std::string, Entry, std::less<>> &Entries() const { return keydir; }
+    std::string_view MeaningOf(const Entry &entry) const { return std::string_view(contents.data() + entry.meaningOffset, entry.meaningSize); }
+    bool Empty() const { return keydir.empty(); }
+    const std::string &Path() const { return path; }
+
+private:
+    // Parse the record at pos into the keydir and return its size, or 0 if it is torn or corrupt
+    uint64_t IndexRecord(uint64_t pos)
+    {
+        uint32_t checksum, wordSize, meaningSize;
+        const uint64_t fixedSize = sizeof(checksum) + sizeof(wordSize) + sizeof(meaningSize);
+        if (contents.size() - pos < fixedSize)
+            return 0;
+        std::memcpy(&checksum, contents.data() + pos, sizeof(checksum));
+        std::memcpy(&wordSize, contents.data() + pos + sizeof(checksum), sizeof(wordSize));
+        std::memcpy(&meaningSize, contents.data() + pos + sizeof(checksum) + sizeof(wordSize), sizeof(meaningSize));
+
+        bool deleted = meaningSize == kTombstone;
+        uint64_t payloadSize = static_cast<uint64_t>(wordSize) + (deleted ? 0 : meaningSize);
+        if (contents.size() - pos - fixedSize < payloadSize)
+            return 0;
+        std::string_view word(contents.data() + pos + fixedSize, wordSize);
+        std::string_view meaning(contents.data() + pos + fixedSize + wordSize, deleted ? 0 : meaningSize);
+        if (RecordChecksum(wordSize, meaningSize, word, meaning) != checksum)
+            return 0;
+
+        keydir[contents.substr(pos + fixedSize, wordSize)] = {pos + fixedSize + wordSize, deleted ? 0 : meaningSize, deleted};
+        return fixedSize + payloadSize;
+    }
+
+    bool Append(const std::string &word, const std::string &meaning, bool deleted)
+    {
+        uint32_t wordSize = word.size();
+        uint32_t meaningSize = deleted ? kTombstone : static_cast<uint32_t>(meaning.size());
+        uint32_t checksum = RecordChecksum(wordSize, meaningSize, word, meaning);
+
+        // Build the whole record first so it reaches the file with a single write
+        std::string record;
+        record.append(reinterpret_cast<const char *>(&checksum), sizeof(checksum));
+        record.append(reinterpret_cast<const char *>(&wordSize), sizeof(wordSize));
+        record.append(reinterpret_cast<const char *>(&meaningSize), sizeof(meaningSize));
+        record += word;
+        record += meaning;
+
+        size_t written = 0;
+        while (written < record.size())
+        {
+            ssize_t n = write(fd, record.data() + written, record.size() - written);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+            {
+                std::cerr << "Failed to append to " << path << ": " << std::strerror(errno) << std::endl;
+                return false;
+            }
+            written += static_cast<size_t>(n);
+        }
+        metrics.Add(Counter::RecordsWritten);
+
+        auto now = std::chrono::steady_clock::now();
+        if (sync.policy == SyncPolicy::Always || (sync.policy == SyncPolicy::Interval && now - lastSync >= sync.interval))
+        {
+            fdatasync(fd);
+            lastSync = now;
+        }
+
+        uint64_t pos = contents.size();
+        contents += record;
+        IndexRecord(pos);
+        return true;
+    }
+
+    std::string path;
+    std::string contents;
+    std::map<std::string, Entry, std::less<>> keydir;
+    int fd = -1;
+    SyncOptions sync;
+    std::chrono::steady_clock::time_point lastSync;
+};
+
+void SyncFile(const std::string &path)
+{
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return;
+    fsync(fd);
+    close(fd);
+}
+
+// Replace a small file with write-then-rename, so readers see the old contents or the new ones
+// whole. The rename itself is durable once the directory is synced.
+bool WriteFileAtomically(const std::string &path, const std::string &contents)
+{
+    std::string temporaryPath = path + ".tmp" + std::to_string(getpid()); // Concurrent writers never share one
+    int fd = open(temporaryPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    bool written = fd >= 0 && write(fd, contents.data(), contents.size()) == static_cast<ssize_t>(contents.size()) && fsync(fd) == 0;
+    if (fd >= 0)
+        close(fd);
+    if (!written || rename(temporaryPath.c_str(), path.c_str()) != 0)
+    {
+        int error = errno;
+        unlink(temporaryPath.c_str());
+        errno = error;
+        return false;
+    }
+    std::string directory = std::filesystem::path(path).parent_path().string();
+    SyncFile(directory.empty() ? "." : directory);
+    return true;
+}
+
+// A sharded dictionary hash-partitions its words into shard files, each an ordinary dictionary,
+// under a text manifest at the dictionary's path. Every command that takes a dictionary path
+// accepts the manifest; lookups open only the one shard a word routes to.
+const char kShardManifestMagic[] = "bitcask-shards\n";
+const uint32_t kMaxShards = 1024;
+
+struct ShardManifest
+{
+    uint32_t version = 0;
+    uint64_t entryCount = 0;
+    std::vector<std::string> shardPaths; // In shard order, resolved against the manifest's directory
+};
+
+// Shard of a word. The routing is stored implicitly in every sharded dictionary, so it must not
+// change between builds; the avalanche keeps it independent of the hint bucket and filter bits,
+// which come from the same FNV hash.
+uint32_t ShardOf(std::string_view word, uint32_t shardCount)
+{
+    uint64_t hash = HashWord(word) + 0x9E3779B97F4A7C15ULL;
+    hash = (hash ^ (hash >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    hash = (hash ^ (hash >> 27)) * 0x94D049BB133111EBULL;
+    hash ^= hash >> 31;
+    return static_cast<uint32_t>((static_cast<unsigned __int128>(hash) * shardCount) >> 64);
+}
+
+std::string ShardPathFor(const std::string &manifestPath, uint32_t shard)
+{
+    return manifestPath + ".shard" + std::to_string(shard);
+}
+
+bool IsShardManifest(const char *data, size_t size)
+{
+    return size >= sizeof(kShardManifestMagic) - 1 && std::memcmp(data, kShardManifestMagic, sizeof(kShardManifestMagic) - 1) == 0;
+}
+
+// False if the file is not a shard manifest, including when it is a plain dictionary
+bool ReadShardManifest(const std::string &path, ShardManifest &manifest)
+{
+    std::ifstream in(path, std::ios::binary);
+    std::string line;
+    if (!std::getline(in, line) || line + "\n" != kShardManifestMagic)
+        return false;
+
+    std::filesystem::path directory = std::filesystem::path(path).parent_path();
+    manifest = ShardManifest();
+    while (std::getline(in, line))
+    {
+        size_t equals = line.find('=');
+        if (equals == std::string::npos)
+            continue;
+        std::string key = line.substr(0, equals), value = line.substr(equals + 1);
+        if (key == "version")
+            manifest.version = static_cast<uint32_t>(std::strtoul(value.c_str(), nullptr, 10));
+        else if (key == "entries")
+            manifest.entryCount = std::strtoull(value.c_str(), nullptr, 10);
+        else if (key == "shard")
+            manifest.shardPaths.push_back((directory / value).string());
+    }
+    return !manifest.shardPaths.empty() && manifest.shardPaths.size() <= kMaxShards;
+}
+
+// Publish a manifest over its shard files once they are on disk. Shards are named by file name,
+// so a sharded dictionary can be moved as a directory.
+bool WriteShardManifest(const std::string &path, const ShardManifest &manifest)
+{
+    std::string contents = kShardManifestMagic;
+    contents += "version=" + std::to_string(manifest.version) + "\nentries=" + std::to_string(manifest.entryCount) + "\n";
+    for (const std::string &shardPath : manifest.shardPaths)
+    {
+        SyncFile(shardPath);
+        SyncFile(HintPathFor(shardPath));
+        contents += "shard=" + std::filesystem::path(shardPath).filename().string() + "\n";
+    }
+    std::filesystem::remove(HintPathFor(path)); // Left by a plain dictionary that was at this path
+    return WriteFileAtomically(path, contents);
+}
+
+// The dictionary files a path stands for: the shards of a manifest, or the path itself
+std::vector<std::string> DictionaryShardFiles(const std::string &path)
+{
+    ShardManifest manifest;
+    if (ReadShardManifest(path, manifest))
+        return manifest.shardPaths;
+    return {path};
+}
+
+// CSV ingestion maps the input and cuts it into chunks of whole lines. Worker threads parse and
+// serialize chunks in parallel while the calling thread appends them to the data section in
+// input order, so offsets and the last-row-wins rule come out as with a sequential read.
+const size_t kIngestChunkSize = 4 * 1024 * 1024; // CSV bytes per chunk, cut at the next newline
+const size_t kIngestChunksPerThread = 2;         // Parsed chunks allowed to wait for the writer, per thread
+
+// First occurrence of a or b in [p, end), or end. SSE2 tests 16 bytes per step.
+const char *FindEither(const char *p, const char *end, char a, char b)
+{
+#if defined(__x86_64__)
+    const __m128i matchA = _mm_set1_epi8(a), matchB = _mm_set1_epi8(b);
+    for (; end - p >= 16; p += 16)
+    {
+        __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+        int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(bytes, matchA), _mm_cmpeq_epi8(bytes, matchB)));
+        if (mask)
+            return p + __builtin_ctz(mask);
+    }
+#endif
+    for (; p < end; ++p)
+    {
+        if (*p == a || *p == b)
+            return p;
+    }
+    return end;
+}
+
+struct IngestChunk
+{
+    const char *begin = nullptr; // Whole lines of the CSV
+    const char *end = nullptr;
+    std::vector<std::string> records; // Serialized records of each shard, back to back
+    std::vector<std::vector<std::tuple<std::string, uint64_t, uint32_t>>> index; // Per shard, offsets into records until appended
+    bool ready = false;
+};
+
+// Parse "word,meaning" lines the way getline did: the word ends at the first comma, and lines
+// without a comma or with an empty meaning are skipped. Rows go to the shard their word routes to.
+void ParseCsvChunk(IngestChunk &chunk, uint32_t shardCount)
+{
+    chunk.records.resize(shardCount);
+    chunk.index.resize(shardCount);
+    size_t expected = static_cast<size_t>(chunk.end - chunk.begin) + (chunk.end - chunk.begin) / 4;
+    for (std::string &records : chunk.records)
+        records.reserve(expected / shardCount);
+    for (const char *line = chunk.begin; line < chunk.end;)
+    {
+        const char *comma = FindEither(line, chunk.end, ',', '\n');
+        if (comma == chunk.end || *comma == '\n')
+        {
+            line = comma + 1;
+            continue;
+        }
+        const char *lineEnd = static_cast<const char *>(std::memchr(comma + 1, '\n', chunk.end - comma - 1)); // memchr is vectorized too
+        if (!lineEnd)
+            lineEnd = chunk.end;
+
+        std::string_view word(line, comma - line), meaning(comma + 1, lineEnd - comma - 1);
+        if (!meaning.empty())
+        {
+            uint32_t shard = shardCount > 1 ? ShardOf(word, shardCount) : 0;
+            uint64_t offset = chunk.records[shard].size();
+            uint32_t blockSize = SerializeRecord(chunk.records[shard], word, meaning);
+            chunk.index[shard].emplace_back(std::string(word), offset, blockSize);
+        }
+        line = lineEnd + 1;
+    }
+}
+
+// Run task(0) .. task(count - 1) on up to threadCount threads
+template <typename Task>
+void RunParallel(size_t count, unsigned threadCount, Task task)
+{
+    std::atomic<size_t> next{0};
+    std::vector<std::thread> threads;
+    for (unsigned t = 1; t < threadCount && t < count; ++t)
+        threads.emplace_back([&]() {
+            for (size_t i; (i = next++) < count;)
+                task(i);
+        });
+    for (size_t i; (i = next++) < count;)
+        task(i);
+    for (auto &thread : threads)
+        thread.join();
+}
+
+// Sort each run by word in parallel, then merge neighbouring runs pairwise until one is left.
+// Equal words keep their input order, earlier runs first, exactly as one stable sort would.
+std::vector<std::tuple<std::string, uint64_t, uint32_t>> SortIndexRuns(std::vector<std::vector<std::tuple<std::string, uint64_t, uint32_t>>> runs, unsigned threadCount)
+{
+    auto byWord = [](const auto &a, const auto &b) { return std::get<0>(a) < std::get<0>(b); };
+    RunParallel(runs.size(), threadCount, [&](size_t i) { std::stable_sort(runs[i].begin(), runs[i].end(), byWord); });
+    while (runs.size() > 1)
+    {
+        std::vector<std::vector<std::tuple<std::string, uint64_t, uint32_t>>> merged((runs.size() + 1) / 2);
+        RunParallel(merged.size(), threadCount, [&](size_t i) {
+            if (2 * i + 1 == runs.size())
+            {
+                merged[i] = std::move(runs[2 * i]);
+                return;
+            }
+            auto &left = runs[2 * i], &right = runs[2 * i + 1];
+            merged[i].reserve(left.size() + right.size());
+            std::merge(std::make_move_iterator(left.begin()), std::make_move_iterator(left.end()),
+                       std::make_move_iterator(right.begin()), std::make_move_iterator(right.end()), std::back_inserter(merged[i]), byWord);
+        });
+        runs = std::move(merged);
+    }
+    return runs.empty() ? std::vector<std::tuple<std::string, uint64_t, uint32_t>>() : std::move(runs.front());
+}
+
+// Keep only the last of each run of equal words in a sorted index
+void DropOverriddenEntries(std::vector<std::tuple<std::string, uint64_t, uint32_t>> &index)
+{
+    auto last = std::unique(index.rbegin(), index.rend(), [](const auto &a, const auto &b) { return std::get<0>(a) == std::get<0>(b); });
+    index.erase(index.begin(), last.base());
+}
+
+// Heap bytes an index entry takes, including a key too long for the string's inline buffer
+size_t IndexEntryBytes(const std::tuple<std::string, uint64_t, uint32_t> &entry)
+{
+    const std::string &word = std::get<0>(entry);
+    return sizeof(entry) + (word.capacity() > std::string().capacity() ? word.capacity() + 1 : 0);
+}
+
+const size_t kMaxRunFanIn = 64;                // Sorted runs merged at once; more are first merged into longer runs
+const size_t kMinRunReadAhead = 64 * 1024;     // Smallest read-ahead per run, whatever the budget
+
+// A sorted, duplicate-free run of index entries spilled to a temporary file. It is stored as a
+// bare front-coded index section, so IndexSectionWriter writes it and IndexStream reads it back.
+struct SortedRun
+{
+    std::string path;
+    BitcaskHeader header = {0, 0, 0, 0};
+};
+
+// Start a run file; the caller adds the entries in order and flushes them
+bool CreateSortedRun(const std::string &path, SortedRun &run, std::ofstream &out)
+{
+    run.path = path;
+    out.open(path, std::ios::binary | std::ios::trunc);
+    return out.is_open();
+}
+
+// Merge runs given in increasing precedence, calling emit(word, offset, blockSize) once per word
+// with the entry from the latest run that holds it
+template <typename Emit>
+bool MergeSortedRuns(const std::vector<SortedRun> &runs, size_t readAhead, Emit emit)
+{
+    std::vector<std::unique_ptr<IndexStream>> streams;
+    for (const SortedRun &run : runs)
+    {
+        streams.push_back(std::make_unique<IndexStream>(readAhead));
+        if (!streams.back()->Open(run.path, run.header))
+            return false;
+    }
+
+    // The heap top is the smallest word, and among equal words the latest run
+    auto laterInHeap = [&streams](size_t a, size_t b) {
+        int cmp = streams[a]->Key().compare(streams[b]->Key());
+        return cmp > 0 || (cmp == 0 && a < b);
+    };
+    std::priority_queue<size_t, std::vector<size_t>, decltype(laterInHeap)> heap(laterInHeap);
+    for (size_t i = 0; i < streams.size(); ++i)
+    {
+        if (streams[i]->Next())
+            heap.push(i);
+    }
+
+    std::vector<size_t> advanced;
+    while (!heap.empty())
+    {
+        size_t winner = heap.top();
+        heap.pop();
+        emit(streams[winner]->Key(), streams[winner]->DataOffset(), streams[winner]->BlockSize());
+
+        advanced.assign(1, winner);
+        while (!heap.empty() && streams[heap.top()]->Key() == streams[winner]->Key())
+        {
+            advanced.push_back(heap.top());
+            heap.pop();
+        }
+        for (size_t i : advanced)
+        {
+            if (streams[i]->Next())
+                heap.push(i);
+        }
+    }
+    return true;
+}
+
+// One output file of --create-dict: its data section as it is appended, and the index entries
+// not yet sorted or spilled to run files
+struct ShardBuild
+{
+    std::string path;
+    std::ofstream out;
+    BitcaskHeader header;
+    uint64_t dataStart = 0;
+    std::unique_ptr<DataSectionWriter> dataWriter;
+    std::vector<std::vector<std::tuple<std::string, uint64_t, uint32_t>>> pending;
+    std::vector<SortedRun> runs;
+    size_t runFiles = 0; // Numbers the run files, which outlive their place in runs
+    bool spillFailed = false;
+};
+
+// Sort the pending index entries of a shard into a run file
+bool SpillShardIndex(ShardBuild &shard, unsigned threadCount)
+{
+    std::vector<std::tuple<std::string, uint64_t, uint32_t>> sorted = SortIndexRuns(std::move(shard.pending), threadCount);
+    shard.pending.clear();
+    DropOverriddenEntries(sorted);
+
+    shard.runs.emplace_back();
+    std::ofstream runFile;
+    if (!CreateSortedRun(shard.path + ".run" + std::to_string(shard.runFiles++), shard.runs.back(), runFile))
+        return false;
+    IndexSectionWriter runWriter(runFile, shard.runs.back().header);
+    for (const auto &entry : sorted)
+        runWriter.Add(std::get<0>(entry), std::get<1>(entry), std::get<2>(entry));
+    runWriter.FlushEntries();
+    BITCASK_LOG(Debug, "Spilled sorted run " << shard.runs.back().path << " with " << sorted.size() << " entries");
+    return static_cast<bool>(runFile.flush());
+}
+
+// Write the index, filter and header of a shard whose records are all in. memoryBudget is this
+// shard's share of the sort memory budget.
+bool FinishShard(ShardBuild &shard, unsigned threadCount, size_t memoryBudget)
+{
+    if (!shard.dataWriter->Finish())
+    {
+        std::cerr << "Failed to write the data section of " << shard.path << std::endl;
+        for (const SortedRun &run : shard.runs)
+            std::filesystem::remove(run.path);
+        return false;
+    }
+
+    BITCASK_LOG(Debug, "Index section starts at offset: " << shard.out.tellp());
+    IndexSectionWriter indexWriter(shard.out, shard.header);
+    auto addEntry = [&indexWriter](std::string_view word, uint64_t offset, uint32_t blockSize) { indexWriter.Add(word, offset, blockSize); };
+    if (shard.runs.empty())
+    {
+        std::vector<std::tuple<std::string, uint64_t, uint32_t>> index = SortIndexRuns(std::move(shard.pending), threadCount);
+        DropOverriddenEntries(index);
+        for (const auto &entry : index)
+            addEntry(std::get<0>(entry), std::get<1>(entry), std::get<2>(entry));
+    }
+    else
+    {
+        bool &spillFailed = shard.spillFailed;
+        std::vector<SortedRun> &runs = shard.runs;
+        if (!spillFailed && !shard.pending.empty())
+            spillFailed = !SpillShardIndex(shard, threadCount);
+
+        // Merge the oldest runs into one until few enough are left to merge in a single pass
+        size_t readAhead = std::clamp(memoryBudget / std::min(runs.size(), kMaxRunFanIn), kMinRunReadAhead, kIndexReadAhead);
+        while (!spillFailed && runs.size() > kMaxRunFanIn)
+        {
+            std::vector<SortedRun> oldest(runs.begin(), runs.begin() + kMaxRunFanIn);
+            SortedRun merged;
+            std::ofstream mergedFile;
+            spillFailed = !CreateSortedRun(shard.path + ".run" + std::to_string(shard.runFiles++), merged, mergedFile);
+            if (spillFailed)
+                break;
+            IndexSectionWriter runWriter(mergedFile, merged.header);
+            spillFailed = !MergeSortedRuns(oldest, readAhead, [&runWriter](std::string_view word, uint64_t offset, uint32_t blockSize) { runWriter.Add(word, offset, blockSize); });
+            runWriter.FlushEntries();
+            spillFailed = spillFailed || !mergedFile.flush();
+            for (const SortedRun &run : oldest)
+                std::filesystem::remove(run.path);
+            runs.erase(runs.begin(), runs.begin() + kMaxRunFanIn);
+            runs.insert(runs.begin(), merged);
+        }
+        BITCASK_LOG(Info, "Merging " << runs.size() << " sorted runs");
+        spillFailed = spillFailed || !MergeSortedRuns(runs, readAhead, addEntry);
+        for (const SortedRun &run : runs)
+            std::filesystem::remove(run.path);
+        if (spillFailed)
+        {
+            std::cerr << "Failed to sort the index through run files next to " << shard.path << std::endl;
+            return false;
+        }
+    }
+    if (!indexWriter.Finish(shard.path))
+    {
+        std::cerr << "Failed to write the index of " << shard.path << std::endl;
+        return false;
+    }
+    WriteFilterSection(shard.out, shard.path, shard.header);
+    if (buildPerfectHash)
+        WritePerfectHashSection(shard.out, shard.path, shard.header);
+    shard.dataWriter->WriteBlockTable(shard.header);
+
+    // Update header with correct offsets
+    shard.header.dataOffset = shard.dataStart;
+    shard.out.seekp(0); // Go back to the start to write the header
+    shard.header.WriteToFile(shard.out);
+    shard.out.close();
+    WriteHintFile(shard.path, shard.header);
+    return true;
+}
+
+// Build a dictionary from a CSV, split into dictionaryShards shard files under a manifest when
+// that is more than one. The CSV is parsed once: workers route each row to its shard, the calling
+// thread appends every shard's records in input order, and the shards are then sorted and
+// finished in parallel.
+bool CreateDictionary(const std::string &csvFilePath, const std::string &bitcaskFilePath, unsigned threadCount)
+{
+    // Map the CSV; pipes and empty files are read into memory instead
+    MappedFile csvMapping;
+    std::string csvContents;
+    const char *csv = nullptr;
+    size_t csvSize = 0;
+    if (csvMapping.Open(csvFilePath))
+    {
+        csv = csvMapping.Data();
+        csvSize = csvMapping.Size();
+        madvise(const_cast<char *>(csv), csvSize, MADV_SEQUENTIAL);
+    }
+    else
+    {
+        std::ifstream inFile(csvFilePath, std::ios::binary);
+        if (!inFile.is_open())
+        {
+            std::cerr << "Failed to open CSV file " << csvFilePath << std::endl;
+            return false;
+        }
+        csvContents.assign(std::istreambuf_iterator<char>(inFile), std::istreambuf_iterator<char>());
+        csv = csvContents.data();
+        csvSize = csvContents.size();
+    }
+
+    const uint32_t shardCount = std::max(1u, dictionaryShards);
+    std::vector<std::unique_ptr<ShardBuild>> shards;
+    for (uint32_t i = 0; i < shardCount; ++i)
+    {
+        shards.push_back(std::make_unique<ShardBuild>());
+        ShardBuild &shard = *shards.back();
+        shard.path = shardCount > 1 ? ShardPathFor(bitcaskFilePath, i) : bitcaskFilePath;
+        shard.out.open(shard.path, std::ios::binary);
+        if (!shard.out.is_open())
+        {
+            std::cerr << "Failed to create dictionary file " << shard.path << std::endl;
+            return false;
+        }
+        shard.header = {static_cast<uint32_t>(std::stoi(version)), 0, 0, 0}; // Initialize header with defaults
+        shard.out.seekp(sizeof(BitcaskHeader));                              // Reserve space for the header
+        shard.dataStart = shard.out.tellp();
+        shard.dataWriter = std::make_unique<DataSectionWriter>(shard.out, compressData);
+        if (directIo)
+            shard.dataWriter->EnableWriteBehind(shard.path);
+    }
+
+    // Cut the CSV into chunks that end on a newline
+    std::vector<IngestChunk> chunks;
+    for (size_t start = 0; start < csvSize;)
+    {
+        size_t end = std::min(start + kIngestChunkSize, csvSize);
+        const char *newline = static_cast<const char *>(std::memchr(csv + end - 1, '\n', csvSize - end + 1));
+        end = newline ? static_cast<size_t>(newline - csv) + 1 : csvSize;
+        chunks.emplace_back();
+        chunks.back().begin = csv + start;
+        chunks.back().end = csv + end;
+        start = end;
+    }
+
+    // Workers claim chunks in order, staying within a window of the writer
+    const unsigned requestedThreads = threadCount;
+    threadCount = static_cast<unsigned>(std::max<size_t>(1, std::min<size_t>(threadCount, chunks.size())));
+    const size_t window = threadCount * kIngestChunksPerThread;
+    std::mutex chunksMutex;
+    std::condition_variable chunksChanged;
+    size_t claimed = 0, appended = 0;
+    std::vector<std::thread> workers;
+    for (unsigned t = 0; t < threadCount && !chunks.empty(); ++t)
+    {
+        workers.emplace_back([&]() {
+            while (true)
+            {
+                size_t i;
+                {
+                    std::unique_lock<std::mutex> lock(chunksMutex);
+                    chunksChanged.wait(lock, [&]() { return claimed == chunks.size() || claimed < appended + window; });
+                    if (claimed == chunks.size())
+                        return;
+                    i = claimed++;
+                }
+                ParseCsvChunk(chunks[i], shardCount);
+                {
+                    std::lock_guard<std::mutex> lock(chunksMutex);
+                    chunks[i].ready = true;
+                }
+                chunksChanged.notify_all();
+            }
+        });
+    }
+
+    // Sort the index by word so it can be binary searched and merged; for repeated words the last
+    // row wins. Once the shards together hold more index entries than the memory budget, each
+    // shard sorts and spills its entries to a run file, and the runs are merged once every row is in.
+    size_t pendingBytes = 0;
+    uint64_t rowCount = 0;
+
+    // Append the chunks in input order as they become ready
+    for (IngestChunk &chunk : chunks)
+    {
+        {
+            std::unique_lock<std::mutex> lock(chunksMutex);
+            chunksChanged.wait(lock, [&]() { return chunk.ready; });
+        }
+        for (uint32_t i = 0; i < shardCount; ++i)
+        {
+            ShardBuild &shard = *shards[i];
+            shard.dataWriter->AppendRun(chunk.records[i], chunk.index[i]);
+            if constexpr (LogCompiled(LogLevel::Trace))
+            {
+                if (LogEnabled(LogLevel::Trace))
+                {
+                    for (const auto &entry : chunk.index[i])
+                        BITCASK_LOG(Trace, "Writing entry for word: '" << std::get<0>(entry) << "' at offset: " << std::get<1>(entry) << ", block size: " << std::get<2>(entry));
+                }
+            }
+            std::string().swap(chunk.records[i]);
+            rowCount += chunk.index[i].size();
+            for (const auto &entry : chunk.index[i])
+                pendingBytes += IndexEntryBytes(entry);
+            shard.pending.push_back(std::move(chunk.index[i]));
+        }
+        if (sortMemoryBudget != 0 && pendingBytes >= sortMemoryBudget)
+        {
+            for (auto &shard : shards)
+            {
+                if (!shard->spillFailed && !shard->pending.empty())
+                    shard->spillFailed = !SpillShardIndex(*shard, threadCount);
+            }
+            pendingBytes = 0;
+        }
+        {
+            std::lock_guard<std::mutex> lock(chunksMutex);
+            appended++;
+        }
+        chunksChanged.notify_all();
+    }
+    for (auto &worker : workers)
+        worker.join();
+    BITCASK_LOG(Info, "Parsed " << rowCount << " rows from " << csvFilePath << " with " << threadCount << " threads");
+
+    // Shards finish side by side, sharing the threads and the memory budget
+    unsigned parallelShards = std::max(1u, std::min(requestedThreads, shardCount));
+    unsigned threadsPerShard = shardCount > 1 ? std::max(1u, requestedThreads / parallelShards) : threadCount;
+    std::vector<char> finished(shardCount, 0);
+    RunParallel(shardCount, parallelShards, [&](size_t i) { finished[i] = FinishShard(*shards[i], threadsPerShard, sortMemoryBudget / parallelShards); });
+    if (std::find(finished.begin(), finished.end(), 0) != finished.end())
+        return false;
+
+    if (shardCount == 1)
+    {
+        const BitcaskHeader &header = shards[0]->header;
+        BITCASK_LOG(Info, "Header updated with data offset: " << header.dataOffset
+                          << ", index offset: " << header.indexOffset
+                          << ", entry count: " << header.entryCount);
+        return true;
+    }
+
+    ShardManifest manifest;
+    manifest.version = shards[0]->header.version;
+    for (const auto &shard : shards)
+    {
+        manifest.entryCount += shard->header.entryCount;
+        manifest.shardPaths.push_back(shard->path);
+    }
+    if (!WriteShardManifest(bitcaskFilePath, manifest))
+    {
+        std::cerr << "Failed to write the shard manifest " << bitcaskFilePath << ": " << std::strerror(errno) << std::endl;
+        return false;
+    }
+    BITCASK_LOG(Info, "Wrote " << manifest.entryCount << " entries in " << shardCount << " shards under " << bitcaskFilePath);
+    return true;
+}
+
+// Read the encoded index entries of a dictionary in one go. Legacy files have nothing after the index.
+bool ReadIndexBytes(std::ifstream &inFile, const BitcaskHeader &header, std::vector<char> &bytes)
+{
+    inFile.seekg(0, std::ios::end);
+    uint64_t fileSize = static_cast<uint64_t>(inFile.tellg());
+    uint64_t indexEnd = header.HasSortedIndex() ? header.fenceOffset : fileSize;
+    if (header.indexOffset > indexEnd || indexEnd > fileSize)
+        return false;
+    bytes.resize(indexEnd - header.indexOffset);
+    inFile.seekg(header.indexOffset);
+    return static_cast<bool>(inFile.read(bytes.data(), bytes.size()));
+}
+
+void LoadIndex(const std::string &dictPath, std::map<std::string, std::pair<uint64_t, uint32_t>> &index = inMemoryIndex)
+{
+    std::ifstream inFile(dictPath, std::ios::binary);
+    if (!inFile.is_open())
+    {
+        std::cerr << "Failed to open dictionary file " << dictPath << " for index loading." << std::endl;
+        return;
+    }
+
+    BitcaskHeader header;
+    header.ReadFromFile(inFile); // Read the header to get index offset and entry count
+    std::vector<char> bytes;
+    if (!ReadIndexBytes(inFile, header, bytes))
+    {
+        std::cerr << "Failed to read the index of " << dictPath << std::endl;
+        return;
+    }
+
+    IndexDecoder decoder(header);
+    size_t pos = 0;
+    for (uint32_t i = 0; i < header.entryCount && decoder.Next(bytes.data(), bytes.size(), pos); ++i)
+    {
+        index[decoder.Key()] = {decoder.DataOffset(), decoder.BlockSize()}; // Store both offset and block size
+    }
+
+    inFile.close();
+    BITCASK_LOG(Info, "Index loaded into memory with " << index.size() << " entries.");
+}
+
+void PrintActiveSegment(const std::string &bitcaskFilePath, std::ostream &out)
+{
+    ActiveSegment segment;
+    segment.Load(bitcaskFilePath);
+    if (!segment.Empty())
+    {
+        out << "Active segment " << segment.Path() << " holds " << segment.Entries().size()
+            << " pending entries, run --compact to fold them in:\n";
+        for (const auto &entry : segment.Entries())
+        {
+            if (entry.second.deleted)
+                out << "  Deleted: '" << entry.first << "'\n";
+            else
+                out << "  Put: '" << entry.first << "', Meaning: '" << segment.MeaningOf(entry.second) << "'\n";
+        }
+    }
+}
+
+// Full scans cut the entries they visit into segments at record boundaries. Each worker reads a
+// segment's records in offset order with large coalesced reads and formats them in visiting
+// order; finished segments are written out in order, threadCount at a time. When the records are
+// stored in visiting order, as after a merge or in an export, the workers walk adjacent stretches
+// of the data section front to back.
+const uint64_t kScanSegmentBytes = 8 * 1024 * 1024;  // Record bytes per segment
+const size_t kScanSegmentEntries = 64 * 1024;         // Entries per segment, so tiny records still split
+const uint64_t kScanGap = 256 * 1024;                 // Most dead bytes read through rather than split a read
+const uint64_t kScanPage = 4096;                      // Gaps this small are always read through
+const uint64_t kScanReadAhead = 4 * 1024 * 1024;      // Upper bound on a single read
+
+struct ScanEntry
+{
+    size_t wordEnd; // End of the entry's index word in the segment's words, empty when not kept
+    uint64_t location;
+    uint32_t blockSize;
+};
+
+struct ScanSegment
+{
+    std::string words;
+    std::vector<ScanEntry> entries;
+    uint64_t recordBytes = 0;
+    std::string output;
+
+    void Clear()
+    {
+        words.clear();
+        entries.clear();
+        recordBytes = 0;
+        output.clear();
+    }
+};
+
+// Read a segment's records and append format(output, indexWord, location, blockSize, record) for
+// each entry in order; record is nullptr when it cannot be read
+template <typename Format>
+void ScanSegmentRecords(const FileReader &file, const BitcaskHeader &header, const BlockTable &blocks, ScanSegment &segment, Format &format)
+{
+    std::vector<size_t> order(segment.entries.size());
+    for (size_t i = 0; i < order.size(); ++i)
+        order[i] = i;
+    auto byLocation = [&segment](size_t a, size_t b) { return segment.entries[a].location < segment.entries[b].location; };
+    if (!std::is_sorted(order.begin(), order.end(), byLocation))
+        std::sort(order.begin(), order.end(), byLocation);
+
+    std::vector<const char *> records(segment.entries.size(), nullptr);
+    std::vector<char> buffer;
+    std::vector<std::vector<char>> blockRecords;
+    if (header.HasCompressedBlocks())
+    {
+        // In location order each block is inflated once; records are copied out before the next
+        blockRecords.resize(segment.entries.size());
+        for (size_t i : order)
+        {
+            const ScanEntry &entry = segment.entries[i];
+            const char *record = blocks.FetchRecord(file, entry.location, entry.blockSize);
+            if (record)
+            {
+                blockRecords[i].assign(record, record + entry.blockSize);
+                records[i] = blockRecords[i].data();
+            }
+        }
+    }
+    else
+    {
+        std::vector<ReadRequest> reads;
+        std::vector<size_t> readFirst, positions;
+        uint64_t bufferBytes = 0;
+        for (size_t k = 0; k < order.size();)
+        {
+            // A gap is read through when it is no larger than a page or than the bytes the read
+            // already needs, so scattered records do not drag the whole file in
+            uint64_t start = segment.entries[order[k]].location;
+            uint64_t end = start + segment.entries[order[k]].blockSize, needed = end - start;
+            size_t last = k + 1;
+            while (last < order.size())
+            {
+                const ScanEntry &next = segment.entries[order[last]];
+                uint64_t nextEnd = std::max(end, next.location + next.blockSize);
+                uint64_t gap = next.location > end ? next.location - end : 0;
+                if (gap > std::min(kScanGap, std::max(kScanPage, needed)) || nextEnd - start > kScanReadAhead)
+                    break;
+                needed += next.blockSize;
+                end = nextEnd;
+                last++;
+            }
+            reads.push_back({start, static_cast<size_t>(end - start), nullptr});
+            readFirst.push_back(k);
+            positions.push_back(bufferBytes);
+            bufferBytes += end - start;
+            k = last;
+        }
+        readFirst.push_back(order.size());
+        buffer.resize(bufferBytes);
+        for (size_t r = 0; r < reads.size(); ++r)
+            reads[r].destination = buffer.data() + positions[r];
+        file.ReadMany(reads);
+        for (size_t r = 0; r < reads.size(); ++r)
+        {
+            if (!reads[r].ok)
+                continue;
+            for (size_t k = readFirst[r]; k < readFirst[r + 1]; ++k)
+                records[order[k]] = reads[r].destination + (segment.entries[order[k]].location - reads[r].offset);
+        }
+    }
+
+    size_t wordStart = 0;
+    for (size_t i = 0; i < segment.entries.size(); ++i)
+    {
+        const ScanEntry &entry = segment.entries[i];
+        std::string_view indexWord(segment.words.data() + wordStart, entry.wordEnd - wordStart);
+        wordStart = entry.wordEnd;
+        RecordView record;
+        bool parsed = records[i] && ParseRecord(records[i], entry.blockSize, record);
+        format(segment.output, indexWord, entry.location, entry.blockSize, parsed ? &record : nullptr);
+    }
+}
+
+// Scan the entries next(word, location, blockSize) yields, in that order, writing each
+// segment's output to out as soon as it and every segment before it are done
+template <typename Next, typename Format>
+bool ScanRecords(const FileReader &file, const BitcaskHeader &header, const BlockTable &blocks, unsigned threadCount, Next next, Format format, std::ostream &out)
+{
+    std::vector<ScanSegment> segments(std::max(1u, threadCount));
+    std::string word;
+    uint64_t location;
+    uint32_t blockSize;
+    bool more = true;
+    while (more)
+    {
+        size_t filled = 0;
+        for (; filled < segments.size() && more; ++filled)
+        {
+            ScanSegment &segment = segments[filled];
+            segment.Clear();
+            while (segment.recordBytes < kScanSegmentBytes && segment.entries.size() < kScanSegmentEntries)
+            {
+                if (!(more = next(word, location, blockSize)))
+                    break;
+                segment.words += word;
+                segment.entries.push_back({segment.words.size(), location, blockSize});
+                segment.recordBytes += blockSize;
+            }
+            if (segment.entries.empty())
+                break;
+        }
+        RunParallel(filled, threadCount, [&](size_t i) { ScanSegmentRecords(file, header, blocks, segments[i], format); });
+        for (size_t i = 0; i < filled; ++i)
+            out.write(segments[i].output.data(), segments[i].output.size());
+        if (!out)
+            return false;
+    }
+    return true;
+}
+
+// Print one dictionary file to out; with fastRead, entries come from an index loaded by LoadIndex.
+// Records are read by the scan engine, threadCount segments at a time.
+void ReadDictionaryFile(const std::string &bitcaskFilePath, std::ostream &out, const std::map<std::string, std::pair<uint64_t, uint32_t>> &index, unsigned threadCount)
+{
+    std::ifstream inFile(bitcaskFilePath, std::ios::binary);
+    if (!inFile)
+    {
+        std::cerr << "Failed to open file: " << bitcaskFilePath << "\n";
+        return;
+    }
+
+    // Read the header
+    BitcaskHeader header;
+    header.ReadFromFile(inFile);
+
+    out << "Read Header:\n";
+    out << "  Version: " << header.version << "\n";
+    out << "  Entry Count: " << header.entryCount << "\n";
+    out << "  Data Offset: " << header.dataOffset << "\n";
+    out << "  Index Offset: " << header.indexOffset << "\n";
+    out << "  Format Version: " << (header.magic == kBitcaskMagic ? header.formatVersion : 1) << "\n";
+    if (header.HasCompressedBlocks())
+        out << "  Compressed Blocks: " << header.blockCount << ", Preset Dictionary: " << header.presetSize << " bytes\n";
+    if (header.HasFilter())
+        out << "  Bloom Filter: " << header.filterBlocks * kFilterBlockBytes << " bytes, " << header.filterProbes << " probes\n";
+    if (header.HasPerfectHash())
+        out << "  Perfect Hash: " << header.perfectHashSlotsOffset - header.perfectHashOffset << " bytes, " << header.perfectHashLevels << " levels\n";
+
+    // Records are read through the --io backend; those of a compressed file are copied out of
+    // their decompressed block
+    FileReader dataFile;
+    BlockTable blocks;
+    if (!dataFile.Open(bitcaskFilePath, ReadBackend(IoBackend::Pread)) || (header.HasCompressedBlocks() && !blocks.Load(dataFile, header)))
+    {
+        std::cerr << "Failed to read the block table of " << bitcaskFilePath << "\n";
+        return;
+    }
+
+    auto format = [](std::string &output, std::string_view word, uint64_t offset, uint32_t blockSize, const RecordView *record) {
+        output += "  Index Entry: Word: '";
+        output += word;
+        output += "', Offset: " + std::to_string(offset) + ", Block Size: " + std::to_string(blockSize) + "\n";
+        if (!record)
+        {
+            std::cerr << "Error reading record for '" << word << "'." << std::endl;
+            return;
+        }
+        BITCASK_LOG(Debug, "  Data Entry: Word: '" << record->word << "', Checksum: " << record->checksum);
+        output += "  Meaning: '";
+        output += record->meaning;
+        output += "'\n";
+        BITCASK_LOG(Debug, "  Word Size: " << record->word.size() << ", Meaning Size: " << record->meaning.size());
+    };
+
+    // If fastRead is enabled, load the index into memory using the global variable
+    if (fastRead)
+    {
+        BITCASK_LOG(Debug, "Using fastRead mode. Reading index from memory.");
+        if (index.empty())
+        {
+            std::cerr << "Empty Index \n";
+            return;
+        }
+
+        // Iterate over the in-memory index
+        auto it = index.begin();
+        auto next = [&](std::string &word, uint64_t &offset, uint32_t &blockSize) {
+            if (it == index.end())
+                return false;
+            word = it->first;
+            offset = it->second.first;
+            blockSize = it->second.second;
+            ++it;
+            return true;
+        };
+        ScanRecords(dataFile, header, blocks, threadCount, next, format, out);
+    }
+    else
+    {
+        // Read the encoded index, then decode each entry and read its record
+        std::vector<char> indexBytes;
+        if (!ReadIndexBytes(inFile, header, indexBytes))
+        {
+            std::cerr << "Failed to read the index section.\n";
+            return;
+        }
+        out << "Reading Index Entries and Corresponding Data:\n";
+
+        IndexDecoder decoder(header);
+        size_t indexPos = 0;
+        uint32_t decoded = 0;
+        auto next = [&](std::string &word, uint64_t &offset, uint32_t &blockSize) {
+            if (decoded >= header.entryCount || !decoder.Next(indexBytes.data(), indexBytes.size(), indexPos))
+                return false;
+            decoded++;
+            word = decoder.Key();
+            offset = decoder.DataOffset();
+            blockSize = decoder.BlockSize();
+            return true;
+        };
+        ScanRecords(dataFile, header, blocks, threadCount, next, format, out);
+    }
+
+    inFile.close();
+    PrintActiveSegment(bitcaskFilePath, out);
+}
+
+// Print a dictionary. The shards of a sharded dictionary are printed in shard order, each
+// scanned with every thread.
+void ReadDictionary(const std::string &bitcaskFilePath, unsigned threadCount)
+{
+    ShardManifest manifest;
+    if (!ReadShardManifest(bitcaskFilePath, manifest))
+    {
+        ReadDictionaryFile(bitcaskFilePath, std::cout, inMemoryIndex, threadCount);
+        return;
+    }
+
+    std::cout << "Shard Manifest:\n";
+    std::cout << "  Version: " << manifest.version << "\n";
+    std::cout << "  Entry Count: " << manifest.entryCount << "\n";
+    std::cout << "  Shards: " << manifest.shardPaths.size() << "\n";
+    for (size_t shard = 0; shard < manifest.shardPaths.size(); ++shard)
+    {
+        const std::string &shardPath = manifest.shardPaths[shard];
+        std::map<std::string, std::pair<uint64_t, uint32_t>> index;
+        if (fastRead)
+            LoadIndex(shardPath, index);
+        std::cout << "Shard " << shard << ": " << shardPath << "\n";
+        ReadDictionaryFile(shardPath, std::cout, index, threadCount);
+    }
+    PrintActiveSegment(bitcaskFilePath, std::cout);
+}
+
+// Write one dictionary file as "word,meaning" rows in data-section order. The live records are
+// sorted by offset first, so the scan reads the file front to back whatever order the index is
+// in. Words the active segment overrides are left to the caller.
+bool ExportDictionaryFile(const std::string &bitcaskFilePath, const ActiveSegment &segment, std::ostream &out, unsigned threadCount, uint64_t &rows, uint64_t &unwritable)
+{
+    FileReader dataFile;
+    BitcaskHeader header;
+    BlockTable blocks;
+    std::vector<char> headerBytes(sizeof(BitcaskHeader));
+    if (!dataFile.Open(bitcaskFilePath, ReadBackend(IoBackend::Pread)) ||
+        !dataFile.ReadAt(0, std::min<uint64_t>(headerBytes.size(), dataFile.Size()), headerBytes.data()) ||
+        !header.ReadFromBuffer(headerBytes.data(), std::min<uint64_t>(headerBytes.size(), dataFile.Size())) ||
+        (header.HasCompressedBlocks() && !blocks.Load(dataFile, header)))
+    {
+        std::cerr << "Failed to open dictionary file " << bitcaskFilePath << std::endl;
+        return false;
+    }
+
+    std::ifstream inFile(bitcaskFilePath, std::ios::binary);
+    std::vector<char> indexBytes;
+    if (!ReadIndexBytes(inFile, header, indexBytes))
+    {
+        std::cerr << "Failed to read the index of " << bitcaskFilePath << std::endl;
+        return false;
+    }
+    std::vector<std::pair<uint64_t, uint32_t>> live;
+    live.reserve(header.entryCount);
+    IndexDecoder decoder(header);
+    size_t indexPos = 0;
+    std::string_view pendingMeaning;
+    for (uint32_t i = 0; i < header.entryCount && decoder.Next(indexBytes.data(), indexBytes.size(), indexPos); ++i)
+    {
+        if (segment.Empty() || segment.Find(decoder.Key(), pendingMeaning) == ActiveSegment::State::Absent)
+            live.emplace_back(decoder.DataOffset(), decoder.BlockSize());
+    }
+    std::vector<char>().swap(indexBytes);
+    if (!std::is_sorted(live.begin(), live.end()))
+        std::sort(live.begin(), live.end());
+
+    std::atomic<uint64_t> failed{0}, skipped{0};
+    auto format = [&](std::string &output, std::string_view, uint64_t, uint32_t, const RecordView *record) {
+        if (!record)
+        {
+            failed++;
+            return;
+        }
+        // The CSV reader ends a word at its first comma and a meaning at the end of the line
+        if (record->word.find_first_of(",\n") != std::string_view::npos || record->meaning.find('\n') != std::string_view::npos || record->meaning.empty())
+        {
+            skipped++;
+            return;
+        }
+        output += record->word;
+        output += ',';
+        output += record->meaning;
+        output += '\n';
+    };
+    size_t position = 0;
+    auto next = [&](std::string &word, uint64_t &location, uint32_t &blockSize) {
+        if (position == live.size())
+            return false;
+        word.clear();
+        location = live[position].first;
+        blockSize = live[position].second;
+        position++;
+        return true;
+    };
+    bool written = ScanRecords(dataFile, header, blocks, threadCount, next, format, out);
+    if (failed > 0)
+        std::cerr << "Failed to read " << failed << " records of " << bitcaskFilePath << std::endl;
+    rows += live.size() - failed - skipped;
+    unwritable += skipped;
+    return written && failed == 0;
+}
+
+// Export every live word of a dictionary, shards and active segment included, as a CSV that
+// --create-dict reads back. "-" writes to stdout.
+bool ExportCsv(const std::string &bitcaskFilePath, const std::string &outputPath, unsigned threadCount)
+{
+    std::ofstream outputFile;
+    std::ostream *out = &std::cout;
+    if (outputPath != "-")
+    {
+        outputFile.open(outputPath, std::ios::binary | std::ios::trunc);
+        if (!outputFile.is_open())
+        {
+            std::cerr << "Failed to open " << outputPath << " for writing." << std::endl;
+            return false;
+        }
+        out = &outputFile;
+    }
+
+    ActiveSegment segment;
+    segment.Load(bitcaskFilePath);
+    uint64_t rows = 0, unwritable = 0;
+    bool exported = true;
+    for (const std::string &file : DictionaryShardFiles(bitcaskFilePath))
+        exported = ExportDictionaryFile(file, segment, *out, threadCount, rows, unwritable) && exported;
+
+    // Pending puts come last; pending deletes were already left out
+    for (const auto &entry : segment.Entries())
+    {
+        std::string_view meaning = segment.MeaningOf(entry.second);
+        if (entry.second.deleted)
+            continue;
+        if (entry.first.find_first_of(",\n") != std::string::npos || meaning.find('\n') != std::string_view::npos || meaning.empty())
+        {
+            unwritable++;
+            continue;
+        }
+        *out << entry.first << ',' << meaning << '\n';
+        rows++;
+    }
+    out->flush();
+    if (!*out)
+    {
+        std::cerr << "Failed to write " << outputPath << std::endl;
+        return false;
+    }
+    if (unwritable > 0)
+        BITCASK_LOG(Warn, "Left out " << unwritable << " entries whose word holds a comma or a line break, or whose meaning is empty or spans lines.");
+    BITCASK_LOG(Info, "Exported " << rows << " rows from " << bitcaskFilePath);
+    return exported;
+}
+
+// Verification walks every record of the data section, dead ones included, and checks its checksum.
+// Index entries are known record boundaries, so the data section is cut at them into one range per
+// thread and each thread walks its own range; a walk that does not end exactly on the next boundary
+// means a record's sizes are damaged. Compressed blocks are already disjoint ranges, so threads
+// take an even share of the blocks instead and walk each one after inflating it.
+struct VerifyResult
+{
+    uint64_t records = 0;
+    uint64_t mismatches = 0;
+    uint64_t firstBadOffset = UINT64_MAX;
+    bool structureIntact = true;
+};
+
+void VerifyRange(const char *data, uint64_t start, uint64_t end, bool crc32c, VerifyResult &result)
+{
+    const uint64_t fixedSize = 3 * sizeof(uint32_t);
+    uint64_t pos = start;
+    while (pos < end)
+    {
+        RecordView record;
+        if (!ParseRecord(data + pos, end - pos, record))
+        {
+            result.structureIntact = false;
+            result.firstBadOffset = std::min(result.firstBadOffset, pos);
+            return;
+        }
+        result.records++;
+        if (!VerifyRecord(record, crc32c))
+        {
+            result.mismatches++;
+            result.firstBadOffset = std::min(result.firstBadOffset, pos);
+        }
+        pos += fixedSize + record.word.size() + record.meaning.size();
+    }
+}
+
+void VerifyBlocks(const FileReader &file, const BlockTable &blocks, uint32_t first, uint32_t last, bool crc32c, VerifyResult &result)
+{
+    std::vector<char> raw;
+    for (uint32_t block = first; block < last; ++block)
+    {
+        VerifyResult blockResult;
+        if (!blocks.ReadBlock(file, block, raw))
+            blockResult.structureIntact = false, blockResult.firstBadOffset = 0;
+        else
+            VerifyRange(raw.data(), 0, raw.size(), crc32c, blockResult);
+
+        result.records += blockResult.records;
+        result.mismatches += blockResult.mismatches;
+        result.structureIntact = result.structureIntact && blockResult.structureIntact;
+        if (blockResult.firstBadOffset != UINT64_MAX)
+            result.firstBadOffset = std::min(result.firstBadOffset, BlockLocation(block, static_cast<uint32_t>(blockResult.firstBadOffset)));
+    }
+}
+
+// Data offsets of every index entry, sorted
+bool CollectRecordOffsets(const FileReader &file, const BitcaskHeader &header, std::vector<uint64_t> &offsets)
+{
+    uint64_t indexEnd = header.HasSortedIndex() ? header.fenceOffset : file.Size();
+    if (indexEnd > file.Size() || header.indexOffset > indexEnd)
+        return false;
+    const char *data = file.Mapping() + header.indexOffset;
+    size_t size = indexEnd - header.indexOffset, pos = 0;
+
+    IndexDecoder decoder(header);
+    offsets.reserve(header.entryCount);
+    for (uint32_t i = 0; i < header.entryCount; ++i)
+    {
+        if (!decoder.Next(data, size, pos))
+            return false;
+        offsets.push_back(decoder.DataOffset());
+    }
+    std::sort(offsets.begin(), offsets.end());
+    return true;
+}
+
+// Index entries the perfect hash does not lead back to, or UINT64_MAX if it cannot be loaded
+uint64_t CountMisplacedWords(const std::string &bitcaskFilePath, const FileReader &file, const BitcaskHeader &header)
+{
+    PerfectHashIndex perfectHash;
+    if (!perfectHash.Load(bitcaskFilePath, file, header) || header.fenceOffset > file.Size() || header.indexOffset > header.fenceOffset)
+        return UINT64_MAX;
+    const char *data = file.Mapping() + header.indexOffset;
+    size_t size = header.fenceOffset - header.indexOffset, pos = 0;
+
+    IndexDecoder decoder(header);
+    uint64_t misplaced = 0;
+    for (uint32_t i = 0; i < header.entryCount && decoder.Next(data, size, pos); ++i)
+    {
+        uint64_t location;
+        uint32_t blockSize;
+        if (!perfectHash.Find(decoder.Key(), location, blockSize) || location != decoder.DataOffset() || blockSize != decoder.BlockSize())
+            misplaced++;
+    }
+    return misplaced;
+}
+
+bool VerifyDictionary(const std::string &bitcaskFilePath, unsigned threadCount)
+{
+    // Each shard is verified in turn, with every thread on it
+    ShardManifest manifest;
+    if (ReadShardManifest(bitcaskFilePath, manifest))
+    {
+        size_t intactShards = 0;
+        for (const std::string &shardPath : manifest.shardPaths)
+        {
+            std::cout << "Shard " << shardPath << ":" << std::endl;
+            intactShards += VerifyDictionary(shardPath, threadCount);
+        }
+        std::cout << intactShards << " of " << manifest.shardPaths.size() << " shards are intact." << std::endl;
+        return intactShards == manifest.shardPaths.size();
+    }
+
+    FileReader file;
+    BitcaskHeader header;
+    BlockTable blocks;
+    if (!file.Open(bitcaskFilePath, IoBackend::Mmap) || !header.ReadFromBuffer(file.Mapping(), file.Size()) ||
+        header.dataOffset > header.indexOffset || header.indexOffset > file.Size() ||
+        (header.HasCompressedBlocks() && !blocks.Load(file, header)))
+    {
+        std::cerr << "Failed to open dictionary file " << bitcaskFilePath << std::endl;
+        return false;
+    }
+
+    const uint64_t dataStart = header.dataOffset, dataEnd = header.indexOffset;
+    std::vector<VerifyResult> results;
+    std::vector<std::thread> workers;
+    if (header.HasCompressedBlocks())
+    {
+        uint32_t shares = std::max(1u, std::min(threadCount, blocks.Count()));
+        results.resize(shares);
+        for (uint32_t i = 0; i < shares; ++i)
+        {
+            uint32_t first = static_cast<uint32_t>(static_cast<uint64_t>(blocks.Count()) * i / shares);
+            uint32_t last = static_cast<uint32_t>(static_cast<uint64_t>(blocks.Count()) * (i + 1) / shares);
+            workers.emplace_back(VerifyBlocks, std::cref(file), std::cref(blocks), first, last, header.HasCrc32c(), std::ref(results[i]));
+        }
+    }
+    else
+    {
+        std::vector<uint64_t> offsets;
+        if (!CollectRecordOffsets(file, header, offsets))
+        {
+            std::cerr << "Index of " << bitcaskFilePath << " is truncated." << std::endl;
+            return false;
+        }
+
+        // Cut the data section at the index entry nearest each even split
+        std::vector<uint64_t> boundaries = {dataStart};
+        for (unsigned t = 1; t < threadCount; ++t)
+        {
+            uint64_t target = dataStart + (dataEnd - dataStart) * t / threadCount;
+            auto it = std::lower_bound(offsets.begin(), offsets.end(), target);
+            if (it != offsets.end() && *it > boundaries.back() && *it < dataEnd)
+                boundaries.push_back(*it);
+        }
+        boundaries.push_back(dataEnd);
+
+        results.resize(boundaries.size() - 1);
+        for (size_t i = 0; i + 1 < boundaries.size(); ++i)
+            workers.emplace_back(VerifyRange, file.Mapping(), boundaries[i], boundaries[i + 1], header.HasCrc32c(), std::ref(results[i]));
+    }
+    for (auto &worker : workers)
+        worker.join();
+
+    VerifyResult total;
+    for (const auto &result : results)
+    {
+        total.records += result.records;
+        total.mismatches += result.mismatches;
+        total.firstBadOffset = std::min(total.firstBadOffset, result.firstBadOffset);
+        total.structureIntact = total.structureIntact && result.structureIntact;
+    }
+
+    std::cout << "Verified " << total.records << " records (" << (dataEnd - dataStart) << " bytes) with " << results.size() << " threads." << std::endl;
+    std::cout << "Checksum: " << (header.HasCrc32c() ? "CRC32C" : "byte sum (format version 2 or older)") << std::endl;
+
+    // Compressed files report a block and the offset inside it
+    std::string firstBad = "offset " + std::to_string(total.firstBadOffset);
+    if (header.HasCompressedBlocks())
+        firstBad = "block " + std::to_string(total.firstBadOffset >> 32) + ", offset " + std::to_string(total.firstBadOffset & 0xFFFFFFFF);
+
+    bool intact = total.structureIntact && total.mismatches == 0;
+    if (!total.structureIntact)
+        std::cout << "Record sizes are damaged near " << firstBad << "." << std::endl;
+    if (total.mismatches > 0)
+        std::cout << "Checksum mismatches: " << total.mismatches << ", first at " << firstBad << "." << std::endl;
+    std::cout << (intact ? "Data section is intact." : "Data section is corrupt.") << std::endl;
+
+    if (header.HasPerfectHash())
+    {
+        uint64_t misplaced = CountMisplacedWords(bitcaskFilePath, file, header);
+        if (misplaced == UINT64_MAX)
+            std::cout << "Perfect hash is corrupt." << std::endl;
+        else if (misplaced > 0)
+            std::cout << "Perfect hash is corrupt: " << misplaced << " words map to the wrong slot." << std::endl;
+        else
+            std::cout << "Perfect hash maps every word to its slot." << std::endl;
+        intact = intact && misplaced == 0;
+    }
+    return intact;
+}
+
+// The fence table of a sorted index, read with a single read and parsed into views
+struct FenceTable
+{
+    std::vector<char> bytes;
+    std::vector<std::pair<std::string_view, uint64_t>> fences; // Fence word and the offset of its index entry
+};
+
+// Parse table.bytes into fence views
+void ParseFenceTable(FenceTable &table, uint32_t fenceCount)
+{
+    table.fences.clear();
+    size_t pos = 0;
+    for (uint32_t i = 0; i < fenceCount; ++i)
+    {
+        uint32_t wordSize;
+        uint64_t entryOffset;
+        if (pos + sizeof(wordSize) > table.bytes.size())
+            break;
+        std::memcpy(&wordSize, table.bytes.data() + pos, sizeof(wordSize));
+        if (pos + sizeof(wordSize) + wordSize + sizeof(entryOffset) > table.bytes.size())
+            break;
+        std::string_view fenceWord(table.bytes.data() + pos + sizeof(wordSize), wordSize);
+        std::memcpy(&entryOffset, table.bytes.data() + pos + sizeof(wordSize) + wordSize, sizeof(entryOffset));
+        pos += sizeof(wordSize) + wordSize + sizeof(entryOffset);
+        table.fences.emplace_back(fenceWord, entryOffset);
+    }
+}
+
+bool ReadFenceTable(std::ifstream &inFile, const BitcaskHeader &header, FenceTable &table)
+{
+    table.bytes.resize(header.slotsOffset - header.fenceOffset);
+    inFile.seekg(header.fenceOffset);
+    if (!inFile.read(table.bytes.data(), table.bytes.size()))
+    {
+        std::cerr << "Error reading fence table." << std::endl;
+        inFile.clear();
+        return false;
+    }
+    ParseFenceTable(table, header.fenceCount);
+    return true;
+}
+
+// Byte range of the run of index entries that could hold the word, bracketed by the last fence
+// not greater than it and the next one. Returns false when the word sorts before every key.
+bool FindFenceRun(const FenceTable &table, const BitcaskHeader &header, std::string_view word, uint64_t &runStart, uint64_t &runEnd)
+{
+    auto next = std::upper_bound(table.fences.begin(), table.fences.end(), word,
+                                 [](std::string_view w, const auto &fence) { return w < fence.first; });
+    if (next == table.fences.begin())
+        return false;
+    runStart = std::prev(next)->second;
+    runEnd = (next == table.fences.end()) ? header.fenceOffset : next->second;
+    return true;
+}
+
+// Position in a run of index entries read between two fences. Runs start on a restart point,
+// so a fresh decoder can read them.
+struct IndexRunCursor
+{
+    explicit IndexRunCursor(const BitcaskHeader &header) : decoder(header) {}
+
+    void Reset()
+    {
+        decoder.Restart();
+        pos = 0;
+        loaded = false;
+    }
+
+    IndexDecoder decoder;
+    size_t pos = 0;
+    bool loaded = false; // The decoder holds an entry the scan has not moved past yet
+};
+
+// Scan a run of sorted index entries for the word, starting at the cursor. On return the cursor
+// is left on the first entry not smaller than the word, so sorted lookups can resume from there.
+bool FindInIndexRun(const std::vector<char> &run, std::string_view word, IndexRunCursor &cursor, uint64_t &dataOffset, uint32_t &blockSize)
+{
+    while (cursor.loaded || cursor.decoder.Next(run.data(), run.size(), cursor.pos))
+    {
+        cursor.loaded = true;
+        const std::string &storedWord = cursor.decoder.Key();
+        if (storedWord == word)
+        {
+            dataOffset = cursor.decoder.DataOffset();
+            blockSize = cursor.decoder.BlockSize();
+            return true;
+        }
+        if (storedWord > word)
+            return false; // Entries are sorted, so the word is not in this run
+        cursor.loaded = false;
+    }
+    return false;
+}
+
+// Decoded meanings of recently read words, kept in front of the data section. Each shard runs
+// 2Q: a word read for the first time enters a small FIFO, and only a word asked for again after
+// it left the FIFO, while its key is still remembered in the ghost queue, moves to the main LRU
+// queue. A scan over cold words cycles through the FIFO without pushing out the hot set.
+class MeaningCache
+{
+public:
+    struct Stats
+    {
+        uint64_t hits = 0, misses = 0, evictions = 0, entries = 0, bytes = 0;
+    };
+
+    explicit MeaningCache(size_t byteBudget) : shardBudget(std::max<size_t>(byteBudget / kShards, 1)) {}
+    MeaningCache(const MeaningCache &) = delete;
+    MeaningCache &operator=(const MeaningCache &) = delete;
+
+    bool Get(std::string_view word, std::string &meaning)
+    {
+        Shard &shard = ShardOf(word);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto slot = shard.slots.find(word);
+        if (slot == shard.slots.end() || slot->second->queue == Queue::Ghost)
+        {
+            shard.misses++;
+            return false;
+        }
+        if (slot->second->queue == Queue::Main)
+            shard.main.splice(shard.main.begin(), shard.main, slot->second);
+        meaning.assign(slot->second->meaning);
+        shard.hits++;
+        return true;
+    }
+
+    // Remember a meaning just read after Get missed
+    void Put(std::string_view word, std::string_view meaning)
+    {
+        size_t cost = word.size() + meaning.size() + kEntryOverhead;
+        Shard &shard = ShardOf(word);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        if (cost > Shard::InTarget(shardBudget))
+            return; // Would flush the whole FIFO
+        auto slot = shard.slots.find(word);
+        if (slot != shard.slots.end() && slot->second->queue != Queue::Ghost)
+            return; // Another thread got here first
+
+        if (slot != shard.slots.end())
+        {
+            // Asked for again after leaving the FIFO: promote it
+            auto node = slot->second;
+            shard.ghostBytes -= node->word.size() + kEntryOverhead;
+            node->meaning.assign(meaning);
+            node->queue = Queue::Main;
+            shard.main.splice(shard.main.begin(), shard.ghost, node);
+            shard.mainBytes += cost;
+        }
+        else
+        {
+            shard.in.push_front(Node{std::string(word), std::string(meaning), Queue::In});
+            shard.slots.emplace(shard.in.front().word, shard.in.begin());
+            shard.inBytes += cost;
+        }
+        Evict(shard);
+    }
+
+    Stats Totals()
+    {
+        Stats stats;
+        for (Shard &shard : shards)
+        {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            stats.hits += shard.hits;
+            stats.misses += shard.misses;
+            stats.evictions += shard.evictions;
+            stats.entries += shard.in.size() + shard.main.size();
+            stats.bytes += shard.inBytes + shard.mainBytes + shard.ghostBytes;
+        }
+        return stats;
+    }
+
+private:
+    static constexpr size_t kShards = 64;         // Lookups on different words rarely share a lock
+    static constexpr size_t kEntryOverhead = 128; // List node, map slot and string headers of an entry
+
+    enum class Queue : uint8_t
+    {
+        In,    // FIFO of words read once
+        Main,  // LRU of words read again
+        Ghost  // Keys recently dropped from the FIFO, without their meaning
+    };
+
+    struct Node
+    {
+        std::string word;
+        std::string meaning;
+        Queue queue;
+    };
+
+    struct alignas(64) Shard
+    {
+        std::mutex mutex;
+        std::list<Node> in, main, ghost; // Newest first
+        std::unordered_map<std::string_view, std::list<Node>::iterator> slots; // Keys point into the nodes
+        size_t inBytes = 0, mainBytes = 0, ghostBytes = 0;
+        uint64_t hits = 0, misses = 0, evictions = 0;
+
+        // The FIFO and the ghost queue each get a quarter of the budget, as 2Q suggests
+        static size_t InTarget(size_t budget) { return budget / 4; }
+        static size_t GhostTarget(size_t budget) { return budget / 4; }
+    };
+
+    Shard &ShardOf(std::string_view word) { return shards[HashWord(word) % kShards]; }
+
+    void Evict(Shard &shard)
+    {
+        while (shard.inBytes + shard.mainBytes + shard.ghostBytes > shardBudget)
+        {
+            if (!shard.ghost.empty() && (shard.ghostBytes > Shard::GhostTarget(shardBudget) || (shard.in.empty() && shard.main.empty())))
+            {
+                shard.ghostBytes -= shard.ghost.back().word.size() + kEntryOverhead;
+                shard.slots.erase(shard.ghost.back().word);
+                shard.ghost.pop_back();
+            }
+            else if (!shard.in.empty() && (shard.inBytes > Shard::InTarget(shardBudget) || shard.main.empty()))
+            {
+                // Leaves the FIFO, but its key is kept for a while in case it is asked for again
+                auto node = std::prev(shard.in.end());
+                shard.inBytes -= node->word.size() + node->meaning.size() + kEntryOverhead;
+                std::string().swap(node->meaning);
+                node->queue = Queue::Ghost;
+                shard.ghost.splice(shard.ghost.begin(), shard.in, node);
+                shard.ghostBytes += node->word.size() + kEntryOverhead;
+                shard.evictions++;
+            }
+            else if (!shard.main.empty())
+            {
+                shard.mainBytes -= shard.main.back().word.size() + shard.main.back().meaning.size() + kEntryOverhead;
+                shard.slots.erase(shard.main.back().word);
+                shard.main.pop_back();
+                shard.evictions++;
+            }
+            else
+            {
+                break;
+            }
+        }
+    }
+
+    size_t shardBudget;
+    Shard shards[kShards];
+};
+
+// Read-only handle on one dictionary for concurrent lookups. Everything it holds is immutable
+// once Open returns, and records are fetched with pread or straight from a mapping, so any
+// number of threads can call Get at the same time without locks.
+class Dictionary
+{
+public:
+    using ReadMode = IoBackend;
+
+    enum class IndexKind
+    {
+        PerfectHash, // Perfect hash in the dictionary file, mapped
+        Hint,        // Mapped hint file
+        Memory,      // Whole index loaded: a sorted index kept as stored, a legacy one sorted into an array
+        Sorted,      // Sorted index searched on demand: restart points in place, or fences and one run read
+        Sharded      // Shard manifest: each word is looked up in the one shard it routes to
+    };
+
+    struct Options
+    {
+        ReadMode readMode = ReadMode::Mmap;
+        bool loadIndex = false;       // Use the perfect hash, the hint file or an in-memory index instead of searching the sorted index
+        bool verifyChecksums = false; // Treat a record whose checksum does not match as missing
+        size_t cacheBytes = 0;        // Budget of a MeaningCache in front of the data section, 0 for none
+    };
+
+    static std::unique_ptr<Dictionary> Open(const std::string &path, const Options &options)
+    {
+        std::unique_ptr<Dictionary> dictionary(new Dictionary());
+        if (!dictionary->Load(path, options))
+            return nullptr;
+        return dictionary;
+    }
+
+    Dictionary(const Dictionary &) = delete;
+    Dictionary &operator=(const Dictionary &) = delete;
+
+    // Meaning of the word, with the active segment taking precedence over the dictionary.
+    // The meaning is copied into the caller's buffer, which can be reused across calls.
+    bool Get(std::string_view word, std::string &meaning) const
+    {
+        ScopedLatency latency(Latency::Lookup);
+        bool found = Find(word, meaning);
+        metrics.Add(Counter::Lookups);
+        metrics.Add(found ? Counter::Hits : Counter::Misses);
+        return found;
+    }
+
+    // Data block of the word in the dictionary file, ignoring the active segment. For a sharded
+    // dictionary the block is in the file of ShardFor(word). A perfect hash finds a block for
+    // some words that are not stored too, so the record's word has to be checked.
+    bool Locate(std::string_view word, uint64_t &dataOffset, uint32_t &blockSize) const
+    {
+        if (!shards.empty())
+        {
+            const Dictionary *shard = ShardFor(word);
+            return shard && shard->Locate(word, dataOffset, blockSize);
+        }
+        if (!MayContain(word))
+        {
+            metrics.Add(Counter::FilterRejects);
+            return false;
+        }
+        switch (indexKind)
+        {
+        case IndexKind::PerfectHash:
+            return perfectHash.Find(word, dataOffset, blockSize);
+        case IndexKind::Hint:
+            return hint.Find(word, dataOffset, blockSize);
+        case IndexKind::Memory:
+        {
+            if (indexResident)
+                return SearchRestarts(word, dataOffset, blockSize);
+            auto it = MemoryLowerBound(word);
+            if (it == memoryIndex.end() || it->word != word)
+                return false;
+            dataOffset = it->dataOffset;
+            blockSize = it->blockSize;
+            return true;
+        }
+        default:
+            return file.Mapping() ? SearchRestarts(word, dataOffset, blockSize) : SearchFences(word, dataOffset, blockSize);
+        }
+    }
+
+    // False when the Bloom filter rules the word out of the dictionary file
+    bool MayContain(std::string_view word) const
+    {
+        return !filter || FilterMayContain(filter, header.filterBlocks, header.filterProbes, word);
+    }
+
+    // Visit the live words from `from` onwards in key order, with the active segment applied, until
+    // pastEnd(word) is true or visit(word, meaning) returns false. Finding the first word costs
+    // one binary search, or one fence lookup in pread mode; after that the index is read in order.
+    template <typename PastEnd, typename Visitor>
+    void Scan(std::string_view from, PastEnd pastEnd, Visitor visit) const
+    {
+        auto pending = segment.Entries().lower_bound(from);
+        const auto pendingEnd = segment.Entries().end();
+        bool stopped = false;
+
+        // Segment entries sort in among the dictionary's, replacing or deleting words they share
+        auto visitSegmentBefore = [&](const std::string_view *limit) {
+            while (!stopped && pending != pendingEnd && (!limit || pending->first < *limit))
+            {
+                if (pastEnd(pending->first))
+                    stopped = true;
+                else if (!pending->second.deleted)
+                    stopped = !visit(std::string_view(pending->first), segment.MeaningOf(pending->second));
+                ++pending;
+            }
+        };
+
+        // A stored word, unless the segment replaces or deletes it; readMeaning fetches its meaning
+        std::string meaning;
+        auto visitStored = [&](std::string_view word, auto readMeaning) {
+            visitSegmentBefore(&word);
+            if (stopped || pastEnd(word))
+                return stopped = true, false;
+            if (pending != pendingEnd && pending->first == word)
+            {
+                if (!pending->second.deleted)
+                    stopped = !visit(word, segment.MeaningOf(pending->second));
+                ++pending;
+            }
+            else if (readMeaning(meaning))
+            {
+                stopped = !visit(word, std::string_view(meaning));
+            }
+            return !stopped;
+        };
+
+        if (shards.empty())
+        {
+            ScanIndex(from, [&](std::string_view word, uint64_t dataOffset, uint32_t blockSize) {
+                return visitStored(word, [&](std::string &out) { return ReadMeaning(dataOffset, blockSize, out); });
+            });
+        }
+        else
+        {
+            // Hashing scatters neighbouring words over every shard, so the shards' cursors are
+            // merged through a heap, as MergeSources does, and the scan stops with the visitor
+            std::vector<const Dictionary *> scanned;
+            std::vector<IndexCursor> cursors;
+            cursors.reserve(shards.size());
+            for (size_t i = 0; i < shards.size(); ++i)
+            {
+                if (const Dictionary *shard = Shard(i))
+                {
+                    scanned.push_back(shard);
+                    cursors.emplace_back(*shard, from);
+                }
+            }
+            auto laterInHeap = [&cursors](size_t a, size_t b) { return cursors[a].Word() > cursors[b].Word(); };
+            std::priority_queue<size_t, std::vector<size_t>, decltype(laterInHeap)> heap(laterInHeap);
+            for (size_t i = 0; i < cursors.size(); ++i)
+            {
+                if (cursors[i].Next())
+                    heap.push(i);
+            }
+            while (!heap.empty())
+            {
+                size_t next = heap.top();
+                heap.pop();
+                const IndexCursor &cursor = cursors[next];
+                if (!visitStored(cursor.Word(), [&](std::string &out) { return scanned[next]->ReadMeaning(cursor.DataOffset(), cursor.BlockSize(), out); }))
+                    break;
+                if (cursors[next].Next())
+                    heap.push(next);
+            }
+        }
+        visitSegmentBefore(nullptr);
+    }
+
+    // Meaning of the record an index entry points at, ignoring the active segment. Given a word,
+    // a record holding another word counts as missing.
+    bool ReadMeaning(uint64_t dataOffset, uint32_t blockSize, std::string &meaning, std::optional<std::string_view> word = std::nullopt) const
+    {
+        thread_local std::vector<char> scratch;
+        const char *data = FetchRecord(file, header, blocks, dataOffset, blockSize, scratch);
+        RecordView record;
+        if (!data || !ParseRecord(data, blockSize, record) || (word && record.word != *word))
+            return false;
+        if (verifyChecksums && !VerifyRecord(record, header.HasCrc32c()))
+        {
+            std::cerr << "Checksum mismatch in record at offset " << dataOffset << " of " << path << std::endl;
+            return false;
+        }
+        meaning.assign(record.meaning);
+        return true;
+    }
+
+    const BitcaskHeader &Header() const { return header; }
+    const std::string &Path() const { return path; }
+    IndexKind Kind() const { return indexKind; }
+    const FenceTable &Fences() const { return fences; } // Loaded for sorted lookups in pread mode
+    const ActiveSegment &Segment() const { return segment; }
+    const FileReader &File() const { return file; } // Empty for a sharded dictionary
+    MeaningCache *Cache() const { return cache.get(); } // Null unless Options::cacheBytes was set
+
+    size_t ShardCount() const { return shards.size(); } // 0 unless the path is a shard manifest
+
+    // Shard file of a sharded dictionary, opened with the same options on first use; null if it
+    // cannot be opened. Each lookup loads only the index of the shard it routes to.
+    const Dictionary *Shard(size_t i) const
+    {
+        ShardSlot &slot = *shards[i];
+        std::call_once(slot.opened, [&]() {
+            slot.dictionary = Open(slot.path, shardOptions);
+            if (!slot.dictionary)
+                std::cerr << "Failed to open shard " << slot.path << std::endl;
+        });
+        return slot.dictionary.get();
+    }
+
+    const Dictionary *ShardFor(std::string_view word) const { return Shard(ShardOf(word, static_cast<uint32_t>(shards.size()))); }
+
+private:
+    struct MemoryEntry
+    {
+        std::string word;
+        uint64_t dataOffset;
+        uint32_t blockSize;
+    };
+
+    struct ShardSlot
+    {
+        std::string path;
+        std::once_flag opened;
+        std::unique_ptr<Dictionary> dictionary;
+    };
+
+    static constexpr size_t kScanReadAhead = 256 * 1024; // Index bytes read per refill during a scan
+
+    Dictionary() = default;
+
+    bool Find(std::string_view word, std::string &meaning) const
+    {
+        std::string_view segmentMeaning;
+        switch (segment.Find(word, segmentMeaning))
+        {
+        case ActiveSegment::State::Live:
+            meaning.assign(segmentMeaning);
+            return true;
+        case ActiveSegment::State::Deleted:
+            return false;
+        default:
+            break;
+        }
+
+        if (cache)
+        {
+            if (cache->Get(word, meaning))
+            {
+                metrics.Add(Counter::CacheHits);
+                return true;
+            }
+            metrics.Add(Counter::CacheMisses);
+        }
+
+        uint64_t dataOffset;
+        uint32_t blockSize;
+        const Dictionary *stored = shards.empty() ? this : ShardFor(word);
+        if (!stored || !stored->Locate(word, dataOffset, blockSize) || !stored->ReadMeaning(dataOffset, blockSize, meaning, word))
+            return false;
+        if (cache)
+            cache->Put(word, meaning);
+        return true;
+    }
+
+    bool Load(const std::string &dictionaryPath, const Options &options)
+    {
+        path = dictionaryPath;
+        verifyChecksums = options.verifyChecksums;
+        if (options.cacheBytes > 0)
+            cache = std::make_unique<MeaningCache>(options.cacheBytes);
+        if (!file.Open(path, options.readMode))
+            return false;
+
+        char headerBytes[sizeof(BitcaskHeader)];
+        size_t headerSize = static_cast<size_t>(std::min<uint64_t>(sizeof(headerBytes), file.Size()));
+        if (!file.ReadAt(0, headerSize, headerBytes))
+            return false;
+        if (IsShardManifest(headerBytes, headerSize))
+            return LoadShards(options);
+        if (!header.ReadFromBuffer(headerBytes, headerSize))
+            return false;
+        if (header.HasCompressedBlocks() && !blocks.Load(file, header))
+            return false;
+        if (header.HasFilter() && !LoadFilter())
+            return false;
+
+        segment.Load(path);
+
+        // A legacy index can only be scanned, so it always goes into memory
+        bool perfectHashLoaded = options.loadIndex && header.HasPerfectHash() && perfectHash.Load(path, file, header);
+        if (options.loadIndex && header.HasPerfectHash() && !perfectHashLoaded)
+            std::cerr << "Ignoring corrupt perfect hash in " << path << std::endl;
+        if (perfectHashLoaded)
+        {
+            indexKind = IndexKind::PerfectHash;
+        }
+        else if (options.loadIndex && hint.Open(path, header))
+        {
+            indexKind = IndexKind::Hint;
+        }
+        else if (options.loadIndex || !header.HasSortedIndex())
+        {
+            indexKind = IndexKind::Memory;
+            return LoadMemoryIndex();
+        }
+
+        // Without a mapping, fences find where lookups and scans start reading the sorted index
+        if (!file.Mapping() && header.fenceCount > 0)
+        {
+            fences.bytes.resize(header.slotsOffset - header.fenceOffset);
+            if (!file.ReadAt(header.fenceOffset, fences.bytes.size(), fences.bytes.data()))
+                return false;
+            ParseFenceTable(fences, header.fenceCount);
+        }
+        return true;
+    }
+
+    // The active segment and the meaning cache of a sharded dictionary live here, in front of
+    // every shard; the shards themselves are opened as lookups reach them
+    bool LoadShards(const Options &options)
+    {
+        ShardManifest manifest;
+        if (!ReadShardManifest(path, manifest))
+            return false;
+        indexKind = IndexKind::Sharded;
+        header.version = manifest.version;
+        header.entryCount = static_cast<uint32_t>(manifest.entryCount);
+        shardOptions = options;
+        shardOptions.cacheBytes = 0;
+        for (const std::string &shardPath : manifest.shardPaths)
+        {
+            shards.push_back(std::make_unique<ShardSlot>());
+            shards.back()->path = shardPath;
+        }
+        segment.Load(path);
+        return true;
+    }
+
+    // The filter is used in place from a mapping, or read once
+    bool LoadFilter()
+    {
+        uint64_t size = static_cast<uint64_t>(header.filterBlocks) * kFilterBlockBytes;
+        if (header.filterOffset > file.Size() || size > file.Size() - header.filterOffset)
+            return false;
+        if (file.Mapping())
+        {
+            filter = file.Mapping() + header.filterOffset;
+            return true;
+        }
+        filterBytes.resize(size);
+        filter = filterBytes.data();
+        return file.ReadAt(header.filterOffset, size, filterBytes.data());
+    }
+
+    bool LoadMemoryIndex()
+    {
+        // A sorted index is kept resident as stored, entries, fences and restart table together,
+        // and searched in place like a mapped file
+        if (header.HasSortedIndex())
+        {
+            uint64_t indexEnd = header.slotsOffset + static_cast<uint64_t>(header.RestartCount()) * sizeof(uint64_t);
+            if (!IndexSectionValid() || indexEnd > file.Size())
+                return false;
+            residentIndex.resize(indexEnd - header.indexOffset);
+            indexResident = file.ReadAt(header.indexOffset, residentIndex.size(), residentIndex.data());
+            return indexResident;
+        }
+
+        std::vector<char> bytes(file.Size() - std::min<uint64_t>(header.indexOffset, file.Size()));
+        if (!file.ReadAt(header.indexOffset, bytes.size(), bytes.data()))
+            return false;
+
+        memoryIndex.reserve(header.entryCount);
+        IndexDecoder decoder(header);
+        size_t pos = 0;
+        for (uint32_t i = 0; i < header.entryCount; ++i)
+        {
+            if (!decoder.Next(bytes.data(), bytes.size(), pos))
+                return false;
+            memoryIndex.push_back({decoder.Key(), decoder.DataOffset(), decoder.BlockSize()});
+        }
+
+        // Legacy indexes are in write order and may repeat a word; the last entry wins
+        auto byWord = [](const MemoryEntry &a, const MemoryEntry &b) { return a.word < b.word; };
+        if (!std::is_sorted(memoryIndex.begin(), memoryIndex.end(), byWord))
+        {
+            std::stable_sort(memoryIndex.begin(), memoryIndex.end(), byWord);
+            auto last = std::unique(memoryIndex.rbegin(), memoryIndex.rend(), [](const MemoryEntry &a, const MemoryEntry &b) { return a.word == b.word; });
+            memoryIndex.erase(memoryIndex.begin(), last.base());
+        }
+        return true;
+    }
+
+    std::vector<MemoryEntry>::const_iterator MemoryLowerBound(std::string_view word) const
+    {
+        return std::lower_bound(memoryIndex.begin(), memoryIndex.end(), word,
+                                [](const MemoryEntry &entry, std::string_view w) { return entry.word < w; });
+    }
+
+    bool IndexSectionValid() const
+    {
+        return header.indexOffset <= header.fenceOffset && header.fenceOffset <= header.slotsOffset;
+    }
+
+    // The index section is addressable in place, from the mapping or the resident copy
+    bool IndexInPlace() const { return indexResident || file.Mapping(); }
+
+    // Pointer to index bytes at a file offset; only valid when IndexInPlace()
+    const char *IndexAt(uint64_t offset) const
+    {
+        return indexResident ? residentIndex.data() + (offset - header.indexOffset) : file.Mapping() + offset;
+    }
+
+    bool RestartsInPlace() const
+    {
+        uint64_t available = indexResident ? header.indexOffset + residentIndex.size() : file.Size();
+        return IndexSectionValid() && header.slotsOffset + static_cast<uint64_t>(header.RestartCount()) * sizeof(uint64_t) <= available;
+    }
+
+    // Offset of the last restart point whose key is not greater than word, found by binary
+    // searching the restart table and comparing against the restart keys in place. Returns
+    // false when the word sorts before every key.
+    bool FindRestart(std::string_view word, uint64_t &entryOffset) const
+    {
+        if (!RestartsInPlace())
+            return false;
+        const char *slots = IndexAt(header.slotsOffset);
+        auto restartAt = [&](uint32_t restart, uint64_t &offset, std::string_view &key) {
+            std::memcpy(&offset, slots + static_cast<uint64_t>(restart) * sizeof(uint64_t), sizeof(offset));
+            return offset >= header.indexOffset && offset < header.fenceOffset &&
+                   RestartKey(header, IndexAt(offset), header.fenceOffset - offset, key);
+        };
+
+        uint32_t low = 0, high = header.RestartCount(); // First restart whose key is greater than word
+        while (low < high)
+        {
+            uint32_t mid = low + (high - low) / 2;
+            uint64_t offset;
+            std::string_view key;
+            if (!restartAt(mid, offset, key))
+                return false;
+            if (word < key)
+                high = mid;
+            else
+                low = mid + 1;
+        }
+        std::string_view key;
+        return low > 0 && restartAt(low - 1, entryOffset, key);
+    }
+
+    // Index bytes at a file offset, in place when possible
+    const char *FetchIndex(uint64_t offset, size_t size, std::vector<char> &scratch) const
+    {
+        return indexResident ? IndexAt(offset) : file.Fetch(offset, size, scratch);
+    }
+
+    // Index entries in key order from the first word not smaller than from. The sorted index is
+    // read from the restart point before from in place, or from the fence before it, and decoded
+    // ahead in chunks.
+    class IndexCursor
+    {
+    public:
+        IndexCursor(const Dictionary &dictionary, std::string_view from)
+            : dictionary(&dictionary), from(from), decoder(dictionary.header)
+        {
+            const BitcaskHeader &header = dictionary.header;
+            if (dictionary.indexKind == IndexKind::Memory && !dictionary.indexResident)
+            {
+                memory = true;
+                it = dictionary.MemoryLowerBound(from);
+                return;
+            }
+            if (!dictionary.IndexSectionValid())
+                return;
+
+            pos = header.indexOffset;
+            end = header.fenceOffset;
+            if (dictionary.IndexInPlace())
+            {
+                if (!dictionary.FindRestart(from, pos))
+                    pos = header.indexOffset;
+            }
+            else
+            {
+                const auto &fences = dictionary.fences.fences;
+                auto next = std::upper_bound(fences.begin(), fences.end(), from,
+                                             [](std::string_view w, const auto &fence) { return w < fence.first; });
+                if (next != fences.begin())
+                    pos = std::prev(next)->second;
+            }
+        }
+
+        // Advance to the next entry, false once the index is exhausted
+        bool Next()
+        {
+            if (memory)
+            {
+                if (started)
+                    ++it;
+                started = true;
+                return it != dictionary->memoryIndex.end();
+            }
+            while (true)
+            {
+                while (data && decoder.Next(data, size, used))
+                {
+                    if (decoder.Key() >= from)
+                        return true;
+                }
+                if (data)
+                {
+                    if (used == 0)
+                    {
+                        if (size == end - pos)
+                            return false; // Truncated entry at the end of the index
+                        chunk *= 2;       // An entry larger than the read-ahead
+                    }
+                    pos += used;
+                }
+                if (pos >= end)
+                    return false;
+                size = static_cast<size_t>(std::min<uint64_t>(chunk, end - pos));
+                used = 0;
+                data = dictionary->FetchIndex(pos, size, scratch);
+                if (!data)
+                    return false;
+            }
+        }
+
+        std::string_view Word() const { return memory ? std::string_view(it->word) : std::string_view(decoder.Key()); }
+        uint64_t DataOffset() const { return memory ? it->dataOffset : decoder.DataOffset(); }
+        uint32_t BlockSize() const { return memory ? it->blockSize : decoder.BlockSize(); }
+
+    private:
+        const Dictionary *dictionary;
+        std::string from;
+        bool memory = false, started = false;
+        std::vector<MemoryEntry>::const_iterator it; // Legacy index held in memory
+        IndexDecoder decoder;
+        uint64_t pos = 0, end = 0;
+        size_t chunk = kScanReadAhead, size = 0, used = 0;
+        const char *data = nullptr;
+        std::vector<char> scratch;
+    };
+
+    // Walk index entries in key order from the first word not smaller than from, until visit returns false
+    template <typename Visitor>
+    void ScanIndex(std::string_view from, Visitor visit) const
+    {
+        IndexCursor cursor(*this, from);
+        while (cursor.Next())
+        {
+            if (!visit(cursor.Word(), cursor.DataOffset(), cursor.BlockSize()))
+                return;
+        }
+    }
+
+    // Find the restart point before the word in place, then decode forward from it
+    bool SearchRestarts(std::string_view word, uint64_t &dataOffset, uint32_t &blockSize) const
+    {
+        uint64_t entryOffset;
+        if (!FindRestart(word, entryOffset))
+            return false;
+
+        const char *data = IndexAt(header.indexOffset);
+        size_t size = static_cast<size_t>(header.fenceOffset - header.indexOffset);
+        size_t pos = static_cast<size_t>(entryOffset - header.indexOffset);
+        IndexDecoder decoder(header);
+        while (decoder.Next(data, size, pos))
+        {
+            if (decoder.Key() < word)
+                continue;
+            if (decoder.Key() != word)
+                return false;
+            dataOffset = decoder.DataOffset();
+            blockSize = decoder.BlockSize();
+            return true;
+        }
+        return false;
+    }
+
+    // Bracket the word with the resident fence table, then read and scan that one run of entries
+    bool SearchFences(std::string_view word, uint64_t &dataOffset, uint32_t &blockSize) const
+    {
+        uint64_t runStart, runEnd;
+        if (!FindFenceRun(fences, header, word, runStart, runEnd))
+            return false;
+
+        thread_local std::vector<char> run;
+        run.resize(runEnd - runStart);
+        IndexRunCursor cursor(header);
+        return file.ReadAt(runStart, run.size(), run.data()) && FindInIndexRun(run, word, cursor, dataOffset, blockSize);
+    }
+
+    std::string path;
+    FileReader file;
+    BitcaskHeader header;
+    BlockTable blocks; // Loaded when the data section is compressed
+    IndexKind indexKind = IndexKind::Sorted;
+    PerfectHashIndex perfectHash;
+    HintIndex hint;
+    std::vector<MemoryEntry> memoryIndex; // Legacy unsorted index, sorted by word
+    std::vector<char> residentIndex;      // Sorted index bytes from indexOffset to the end of the restart table
+    bool indexResident = false;
+    const char *filter = nullptr; // Bloom filter, in the mapping or filterBytes
+    std::vector<char> filterBytes;
+    FenceTable fences;
+    ActiveSegment segment; // Snapshot taken at open
+    bool verifyChecksums = false;
+    std::unique_ptr<MeaningCache> cache; // Shared by every thread, locked per shard
+    std::vector<std::unique_ptr<ShardSlot>> shards; // Empty unless the path is a shard manifest
+    Options shardOptions;
+};
+
+void SearchWord(const std::string &word, const std::string &searchDictPath)
+{
+    Dictionary::Options options;
+    options.readMode = ReadBackend(IoBackend::Pread);
+    options.loadIndex = fastRead;
+    options.verifyChecksums = verifyReads;
+    auto dictionary = Dictionary::Open(searchDictPath, options);
+    if (!dictionary)
+    {
+        std::cout << "Failed to open dictionary file." << std::endl;
+        return;
+    }
+
+    if (fastRead)
+    {
+        if (dictionary->Kind() == Dictionary::IndexKind::Sharded)
+            BITCASK_LOG(Info, "Shard manifest with " << dictionary->Header().entryCount << " entries in " << dictionary->ShardCount() << " shards; the word's shard loads its index.");
+        else if (dictionary->Kind() == Dictionary::IndexKind::PerfectHash)
+            BITCASK_LOG(Info, "Perfect hash loaded with " << dictionary->Header().entryCount << " entries.");
+        else if (dictionary->Kind() == Dictionary::IndexKind::Hint)
+            BITCASK_LOG(Info, "Hint file mapped with " << dictionary->Header().entryCount << " entries.");
+        else
+            BITCASK_LOG(Info, "Index loaded into memory with " << dictionary->Header().entryCount << " entries.");
+        BITCASK_LOG(Info, "Fast read mode enabled and index loaded from: " << searchDictPath);
+    }
+
+    std::string meaning;
+    if (dictionary->Get(word, meaning))
+    {
+        std::cout << word << ": " << meaning << std::endl;
+    }
+    else
+    {
+        std::cout << "Word not found: " << word << std::endl;
+    }
+}
+
+// Stream every word in [from, to] in key order, or every word starting with a prefix, as
+// "word: meaning" lines. Prefix scans stop at the first word without the prefix, so both cost
+// a binary search plus one read of the matching stretch of the index.
+void ScanDictionary(const std::string &scanDictPath, const std::string &from, const std::optional<std::string> &to, bool prefix, uint64_t limit)
+{
+    Dictionary::Options options;
+    options.readMode = ReadBackend(IoBackend::Pread);
+    options.loadIndex = fastRead; // Without a hint file, fast-read scans the in-memory sorted array
+    options.verifyChecksums = verifyReads;
+    auto dictionary = Dictionary::Open(scanDictPath, options);
+    if (!dictionary)
+    {
+        std::cerr << "Failed to open dictionary file." << std::endl;
+        return;
+    }
+
+    auto pastEnd = [&](std::string_view word) {
+        if (prefix)
+            return word.compare(0, from.size(), from) != 0;
+        return to && word > *to;
+    };
+
+    uint64_t found = 0;
+    std::string output;
+    dictionary->Scan(from, pastEnd, [&](std::string_view word, std::string_view meaning) {
+        output.append(word).append(": ").append(meaning).append("\n");
+        if (output.size() >= 64 * 1024)
+        {
+            std::cout << output;
+            output.clear();
+        }
+        return ++found < limit;
+    });
+    std::cout << output;
+    std::cout.flush();
+    metrics.Add(Counter::WordsScanned, found);
+    BITCASK_LOG(Info, "Found " << found << " words.");
+}
+
+// Batch lookups resolve a chunk of words against the index first, then read the hits in data
+// offset order, merging nearby records into one large read instead of a seek and read per word
+const uint64_t kCoalesceGap = 64 * 1024;            // Read through gaps up to this size rather than seeking
+const uint64_t kMaxCoalescedRead = 4 * 1024 * 1024; // Upper bound on a single merged read
+const size_t kBatchChunkSize = 64 * 1024;           // Words resolved and printed per round
+
+struct BatchHit
+{
+    uint64_t dataOffset;
+    uint32_t blockSize;
+    size_t queryIndex; // Position of the word in the chunk, so output keeps the input order
+};
+
+// Resolve a chunk of words to data blocks. A mapped index is searched in place; other sorted
+// dictionaries are resolved by visiting the words in key order: every run of index entries the chunk needs is read in one batch, then each run is
+// scanned once, resuming where the last word stopped.
+void ResolveBatch(const std::vector<std::string> &words, const Dictionary &dictionary, std::vector<BatchHit> &hits)
+{
+    hits.clear();
+    if (dictionary.Kind() != Dictionary::IndexKind::Sorted || dictionary.File().Mapping())
+    {
+        for (size_t i = 0; i < words.size(); ++i)
+        {
+            BatchHit hit = {0, 0, i};
+            if (dictionary.Locate(words[i], hit.dataOffset, hit.blockSize))
+                hits.push_back(hit);
+        }
+        return;
+    }
+
+    const BitcaskHeader &header = dictionary.Header();
+    const FenceTable &fences = dictionary.Fences();
+
+    // Words the filter rules out never reach the index
+    std::vector<size_t> order;
+    order.reserve(words.size());
+    for (size_t i = 0; i < words.size(); ++i)
+    {
+        if (dictionary.MayContain(words[i]))
+            order.push_back(i);
+    }
+    metrics.Add(Counter::FilterRejects, words.size() - order.size());
+    std::sort(order.begin(), order.end(), [&words](size_t a, size_t b) { return words[a] < words[b]; });
+
+    // Words in key order need runs in file order, so each run is requested once
+    std::vector<size_t> runOf(order.size(), SIZE_MAX);
+    std::vector<ReadRequest> runs;
+    std::vector<uint64_t> runPositions;
+    uint64_t runBytes = 0;
+    for (size_t i = 0; i < order.size(); ++i)
+    {
+        uint64_t runStart, runEnd;
+        if (!FindFenceRun(fences, header, words[order[i]], runStart, runEnd))
+            continue;
+        if (runs.empty() || runs.back().offset != runStart)
+        {
+            runs.push_back({runStart, static_cast<size_t>(runEnd - runStart), nullptr});
+            runPositions.push_back(runBytes);
+            runBytes += runEnd - runStart;
+        }
+        runOf[i] = runs.size() - 1;
+    }
+    thread_local std::vector<char> runBuffer;
+    runBuffer.resize(runBytes);
+    for (size_t r = 0; r < runs.size(); ++r)
+        runs[r].destination = runBuffer.data() + runPositions[r];
+    dictionary.File().ReadMany(runs);
+
+    std::vector<char> run;
+    size_t loadedRun = SIZE_MAX;
+    IndexRunCursor cursor(header);
+    for (size_t i = 0; i < order.size(); ++i)
+    {
+        if (runOf[i] == SIZE_MAX)
+            continue;
+        const ReadRequest &request = runs[runOf[i]];
+        if (!request.ok)
+        {
+            if (runOf[i] != loadedRun)
+                std::cerr << "Error reading index entries." << std::endl;
+            loadedRun = runOf[i];
+            continue;
+        }
+        if (runOf[i] != loadedRun)
+        {
+            run.assign(request.destination, request.destination + request.size);
+            loadedRun = runOf[i];
+            cursor.Reset();
+        }
+
+        BatchHit hit = {0, 0, order[i]};
+        if (FindInIndexRun(run, words[order[i]], cursor, hit.dataOffset, hit.blockSize))
+            hits.push_back(hit);
+    }
+}
+
+// Read the hits in offset order, coalescing neighbours, and store each meaning by query position.
+// The coalesced reads of a chunk go out as one batch, so the io_uring backend keeps them in flight
+// together. A hit whose record holds another word, as a perfect hash can give, is a miss.
+void ReadBatchHits(const Dictionary &dictionary, const std::vector<std::string> &words, std::vector<BatchHit> &hits, std::vector<std::optional<std::string>> &meanings)
+{
+    std::sort(hits.begin(), hits.end(), [](const BatchHit &a, const BatchHit &b) { return a.dataOffset < b.dataOffset; });
+
+    // Compressed locations sort by block, so each block is inflated once for all its hits
+    const BitcaskHeader &header = dictionary.Header();
+    if (header.HasCompressedBlocks())
+    {
+        std::string meaning;
+        for (const BatchHit &hit : hits)
+        {
+            if (dictionary.ReadMeaning(hit.dataOffset, hit.blockSize, meaning, words[hit.queryIndex]))
+                meanings[hit.queryIndex] = meaning;
+        }
+        return;
+    }
+
+    std::vector<ReadRequest> groups;
+    std::vector<size_t> groupFirst; // First hit of each group, plus an end marker
+    std::vector<uint64_t> groupPositions;
+    uint64_t groupBytes = 0;
+    size_t groupBegin = 0;
+    while (groupBegin < hits.size())
+    {
+        uint64_t groupStart = hits[groupBegin].dataOffset;
+        uint64_t groupEnd = groupStart + hits[groupBegin].blockSize;
+        size_t groupLast = groupBegin + 1;
+        while (groupLast < hits.size())
+        {
+            const BatchHit &next = hits[groupLast];
+            uint64_t nextEnd = std::max(groupEnd, next.dataOffset + next.blockSize);
+            if (next.dataOffset > groupEnd + kCoalesceGap || nextEnd - groupStart > kMaxCoalescedRead)
+                break;
+            groupEnd = nextEnd;
+            groupLast++;
+        }
+        groups.push_back({groupStart, static_cast<size_t>(groupEnd - groupStart), nullptr});
+        groupFirst.push_back(groupBegin);
+        groupPositions.push_back(groupBytes);
+        groupBytes += groupEnd - groupStart;
+        groupBegin = groupLast;
+    }
+    groupFirst.push_back(hits.size());
+
+    thread_local std::vector<char> buffer;
+    buffer.resize(groupBytes);
+    for (size_t g = 0; g < groups.size(); ++g)
+        groups[g].destination = buffer.data() + groupPositions[g];
+    dictionary.File().ReadMany(groups);
+
+    for (size_t g = 0; g < groups.size(); ++g)
+    {
+        if (!groups[g].ok)
+        {
+            std::cerr << "Error reading data section at offset " << groups[g].offset << "." << std::endl;
+            continue;
+        }
+        for (size_t i = groupFirst[g]; i < groupFirst[g + 1]; ++i)
+        {
+            RecordView record;
+            if (!ParseRecord(groups[g].destination + (hits[i].dataOffset - groups[g].offset), hits[i].blockSize, record) ||
+                record.word != words[hits[i].queryIndex])
+                continue;
+            if (verifyReads && !VerifyRecord(record, header.HasCrc32c()))
+            {
+                std::cerr << "Checksum mismatch in record at offset " << hits[i].dataOffset << "." << std::endl;
+                continue;
+            }
+            meanings[hits[i].queryIndex] = std::string(record.meaning);
+        }
+    }
+}
+
+// A chunk of a sharded batch is split by shard, and each shard's words are resolved and read
+// like a batch of their own
+void ReadShardedBatch(const std::vector<std::string> &words, const Dictionary &dictionary, std::vector<std::optional<std::string>> &meanings)
+{
+    std::vector<std::vector<size_t>> positions(dictionary.ShardCount());
+    for (size_t i = 0; i < words.size(); ++i)
+        positions[ShardOf(words[i], static_cast<uint32_t>(positions.size()))].push_back(i);
+
+    meanings.assign(words.size(), std::nullopt);
+    std::vector<std::string> shardWords;
+    std::vector<BatchHit> hits;
+    std::vector<std::optional<std::string>> shardMeanings;
+    for (size_t shard = 0; shard < positions.size(); ++shard)
+    {
+        const Dictionary *shardDictionary = positions[shard].empty() ? nullptr : dictionary.Shard(shard);
+        if (!shardDictionary)
+            continue;
+
+        shardWords.clear();
+        for (size_t position : positions[shard])
+            shardWords.push_back(words[position]);
+        ResolveBatch(shardWords, *shardDictionary, hits);
+        shardMeanings.assign(shardWords.size(), std::nullopt);
+        ReadBatchHits(*shardDictionary, shardWords, hits, shardMeanings);
+        for (size_t i = 0; i < shardWords.size(); ++i)
+            meanings[positions[shard][i]] = std::move(shardMeanings[i]);
+    }
+}
+
+void SearchBatch(const std::string &inputPath, const std::string &searchDictPath)
+{
+    std::ifstream inputFile;
+    std::istream *input = &std::cin;
+    if (inputPath != "-")
+    {
+        inputFile.open(inputPath);
+        if (!inputFile.is_open())
+        {
+            std::cerr << "Failed to open word list " << inputPath << std::endl;
+            return;
+        }
+        input = &inputFile;
+    }
+
+    // The dictionary handle resolves words and reads records, with neighbours coalesced
+    Dictionary::Options options;
+    options.readMode = ReadBackend(IoBackend::Pread);
+    options.loadIndex = fastRead;
+    options.verifyChecksums = verifyReads;
+    auto dictionary = Dictionary::Open(searchDictPath, options);
+    if (!dictionary)
+    {
+        std::cerr << "Failed to open dictionary file." << std::endl;
+        return;
+    }
+    const ActiveSegment &segment = dictionary->Segment();
+    if (fastRead)
+        BITCASK_LOG(Info, "Fast read mode enabled and index loaded from: " << searchDictPath);
+
+    std::vector<std::string> words;
+    std::vector<BatchHit> hits;
+    std::vector<std::optional<std::string>> meanings;
+    std::string line, output;
+    size_t total = 0, found = 0;
+    while (true)
+    {
+        words.clear();
+        while (words.size() < kBatchChunkSize && std::getline(*input, line))
+        {
+            if (!line.empty() && line.back() == '\r')
+                line.pop_back();
+            words.push_back(line);
+        }
+        if (words.empty())
+            break;
+
+        ScopedLatency chunkLatency(Latency::BatchChunk);
+        size_t chunkFound = 0;
+        if (dictionary->ShardCount() > 0)
+        {
+            ReadShardedBatch(words, *dictionary, meanings);
+        }
+        else
+        {
+            ResolveBatch(words, *dictionary, hits);
+            meanings.assign(words.size(), std::nullopt);
+            ReadBatchHits(*dictionary, words, hits, meanings);
+        }
+        if (!segment.Empty())
+        {
+            for (size_t i = 0; i < words.size(); ++i)
+            {
+                std::string_view meaning;
+                ActiveSegment::State state = segment.Find(words[i], meaning);
+                if (state != ActiveSegment::State::Absent)
+                    meanings[i] = (state == ActiveSegment::State::Live) ? std::optional<std::string>(meaning) : std::nullopt;
+            }
+        }
+
+        output.clear();
+        for (size_t i = 0; i < words.size(); ++i)
+        {
+            if (meanings[i])
+            {
+                output += words[i] + ": " + *meanings[i] + "\n";
+                chunkFound++;
+            }
+            else
+            {
+                output += "Word not found: " + words[i] + "\n";
+            }
+        }
+        std::cout << output;
+        total += words.size();
+        found += chunkFound;
+        metrics.Add(Counter::Lookups, words.size());
+        metrics.Add(Counter::Hits, chunkFound);
+        metrics.Add(Counter::Misses, words.size() - chunkFound);
+    }
+    std::cout.flush();
+    BITCASK_LOG(Info, "Searched " << total << " words (" << found << " found).");
+}
+
+// The config is the manifest naming the current dictionary version. It is replaced by writing a
+// temporary file and renaming it over the old one, so a reader sees the old manifest or the new
+// one whole, never a torn mix. The dictionary it names is synced first, so a manifest that
+// survives a crash never names data that did not.
+
+// Read the path and version lines of a config; false if it cannot be opened
+bool LoadConfig(const std::string &path, std::string &loadedPath, std::string &loadedVersion)
+{
+    std::ifstream configIn(path);
+    if (!configIn.is_open())
+        return false;
+    std::string line;
+    while (std::getline(configIn, line))
+    {
+        size_t equals = line.find('=');
+        if (equals == std::string::npos)
+            continue;
+        if (line.compare(0, equals, "path") == 0)
+            loadedPath = line.substr(equals + 1);
+        else if (line.compare(0, equals, "version") == 0)
+            loadedVersion = line.substr(equals + 1);
+    }
+    return true;
+}
+
+// Publish the current dictionary path and version to the config file
+void SaveConfig()
+{
+    SyncFile(dictPath);
+    SyncFile(HintPathFor(dictPath));
+    if (!WriteFileAtomically(configPath, "path=" + dictPath + "\nversion=" + version + "\n"))
+        std::cerr << "Failed to write config " << configPath << ": " << std::strerror(errno) << std::endl;
+}
+
+// Server mode keeps one dictionary mapped with its index resident and answers lookups over a
+// Unix domain socket and stdin. The protocol is one word per line; each reply is one line,
+// either "OK <meaning>" or "NOT_FOUND". Backslashes and line breaks in a meaning are escaped.
+const int kServePollIntervalMs = 200; // How often blocked server threads check for shutdown
+
+volatile std::sig_atomic_t stopServing = 0;
+
+// The dictionary version a long-running reader serves. Readers take a snapshot, a shared
+// reference that keeps its version open and mapped until they let go, so publishing a new
+// version never waits for or disturbs lookups in flight. A replaced version is closed when its
+// last reader lets go; with reclaim, its dictionary and hint files are removed then too.
+class DictionarySnapshots
+{
+public:
+    explicit DictionarySnapshots(bool reclaim) : reclaim(reclaim) {}
+
+    std::shared_ptr<const Dictionary> Acquire() const { return std::atomic_load(&current); }
+
+    // Called by one thread at a time
+    void Publish(std::unique_ptr<Dictionary> dictionary)
+    {
+        auto retired = std::make_shared<std::atomic<bool>>(false);
+        bool removeFiles = reclaim;
+        std::shared_ptr<const Dictionary> next(dictionary.release(), [retired, removeFiles](const Dictionary *released) {
+            std::string path = released->Path();
+            delete released;
+            if (removeFiles && retired->load())
+            {
+                std::error_code error;
+                std::vector<std::string> files = DictionaryShardFiles(path);
+                for (const std::string &file : files)
+                {
+                    std::filesystem::remove(file, error);
+                    std::filesystem::remove(HintPathFor(file), error);
+                }
+                if (files.size() > 1 || files[0] != path)
+                    std::filesystem::remove(path, error);
+                BITCASK_LOG(Info, "Reclaimed " << path);
+            }
+        });
+
+        std::shared_ptr<const Dictionary> previous = Acquire();
+        if (previous && previous->Path() != next->Path())
+            currentRetired->store(true);
+        currentRetired = retired;
+        std::atomic_store(&current, std::move(next));
+    }
+
+private:
+    bool reclaim;
+    std::shared_ptr<const Dictionary> current;
+    std::shared_ptr<std::atomic<bool>> currentRetired;
+};
+
+// Follow the config: when it names another dictionary version, open that and make it current.
+// Publishing replaces the config with a rename, so a changed inode, size or mtime is all a stat
+// has to notice; an unchanged config costs one system call per tick.
+void WatchConfig(DictionarySnapshots &snapshots, const Dictionary::Options &options, const std::atomic<bool> &stop)
+{
+    auto sameFile = [](const struct stat &a, const struct stat &b) {
+        return a.st_ino == b.st_ino && a.st_size == b.st_size && a.st_mtim.tv_sec == b.st_mtim.tv_sec && a.st_mtim.tv_nsec == b.st_mtim.tv_nsec;
+    };
+    struct stat seen = {};
+    stat(configPath.c_str(), &seen);
+    std::string servedPath = snapshots.Acquire()->Path(), servedVersion = version;
+    while (!stop && !stopServing)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(kServePollIntervalMs));
+        struct stat now;
+        if (stat(configPath.c_str(), &now) != 0 || sameFile(now, seen))
+            continue;
+        seen = now;
+
+        std::string nextPath, nextVersion;
+        if (!LoadConfig(configPath, nextPath, nextVersion) || nextPath.empty() || (nextPath == servedPath && nextVersion == servedVersion))
+            continue;
+        auto dictionary = Dictionary::Open(nextPath, options);
+        if (!dictionary)
+        {
+            BITCASK_LOG(Error, "Failed to open " << nextPath << " named by " << configPath << ", still serving " << servedPath);
+            continue;
+        }
+        BITCASK_LOG(Info, "Swapped " << servedPath << " for " << nextPath << " version " << nextVersion << " ("
+                                     << dictionary->Header().entryCount << " entries)");
+        servedPath = nextPath;
+        servedVersion = nextVersion;
+        snapshots.Publish(std::move(dictionary));
+    }
+}
+
+void HandleServeSignal(int)
+{
+    stopServing = 1;
+}
+
+// Append a meaning to a reply with \\, \n and \r escaped, so a reply never spans lines
+void AppendEscapedMeaning(std::string_view meaning, std::string &replies)
+{
+    if (meaning.find_first_of("\\\n\r") == std::string_view::npos)
+    {
+        replies += meaning;
+        return;
+    }
+    for (char c : meaning)
+    {
+        if (c == '\\')
+            replies += "\\\\";
+        else if (c == '\n')
+            replies += "\\n";
+        else if (c == '\r')
+            replies += "\\r";
+        else
+            replies += c;
+    }
+}
+
+void AnswerQuery(const Dictionary &dictionary, std::string_view line, std::string &replies)
+{
+    if (!line.empty() && line.back() == '\r')
+        line.remove_suffix(1);
+
+    thread_local std::string meaning; // Reused by every query on this thread
+    if (dictionary.Get(line, meaning))
+    {
+        replies += "OK ";
+        AppendEscapedMeaning(meaning, replies);
+        replies += '\n';
+    }
+    else
+    {
+        replies += "NOT_FOUND\n";
+    }
+}
+
+bool WriteAll(int fd, const std::string &buffer)
+{
+    size_t written = 0;
+    while (written < buffer.size())
+    {
+        ssize_t n = send(fd, buffer.data() + written, buffer.size() - written, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        written += static_cast<size_t>(n);
+    }
+    return true;
+}
+
+// A socket client and the start of a line it has not finished sending
+struct ServeClient
+{
+    int fd = -1;
+    std::string pending;
+};
+
+// Answer the complete lines of one read from a client that polled readable, batching the
+// replies into one write. The lines are answered from one snapshot, let go before returning.
+// False once the client has closed the connection or cannot be written to.
+bool ServeConnection(const DictionarySnapshots &snapshots, ServeClient &client)
+{
+    thread_local std::vector<char> buffer(64 * 1024);
+    thread_local std::string replies;
+    ssize_t n;
+    while ((n = read(client.fd, buffer.data(), buffer.size())) < 0 && errno == EINTR)
+    {
+    }
+    if (n <= 0)
+        return false;
+
+    client.pending.append(buffer.data(), static_cast<size_t>(n));
+    std::shared_ptr<const Dictionary> dictionary = snapshots.Acquire();
+    size_t lineStart = 0, newline;
+    replies.clear();
+    while ((newline = client.pending.find('\n', lineStart)) != std::string::npos)
+    {
+        AnswerQuery(*dictionary, std::string_view(client.pending).substr(lineStart, newline - lineStart), replies);
+        lineStart = newline + 1;
+    }
+    client.pending.erase(0, lineStart);
+    return replies.empty() || WriteAll(client.fd, replies);
+}
+
+// Answer the lines read from stdin until it ends or the server stops. Stdin is polled like a
+// connection, so a shutdown never waits on a blocked read and the thread can be joined.
+void ServeStdin(const DictionarySnapshots &snapshots)
+{
+    std::string pending, replies;
+    std::vector<char> buffer(64 * 1024);
+    while (!stopServing)
+    {
+        pollfd pfd = {STDIN_FILENO, POLLIN, 0};
+        int ready = poll(&pfd, 1, kServePollIntervalMs);
+        if (ready < 0 && errno != EINTR)
+            break;
+        if (ready <= 0)
+            continue;
+
+        ssize_t n = read(STDIN_FILENO, buffer.data(), buffer.size());
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break; // End of input
+
+        pending.append(buffer.data(), static_cast<size_t>(n));
+        std::shared_ptr<const Dictionary> dictionary = snapshots.Acquire();
+        size_t lineStart = 0, newline;
+        while ((newline = pending.find('\n', lineStart)) != std::string::npos)
+        {
+            AnswerQuery(*dictionary, std::string_view(pending).substr(lineStart, newline - lineStart), replies);
+            lineStart = newline + 1;
+        }
+        pending.erase(0, lineStart);
+
+        // Flushed once per read, not after every line
+        std::cout << replies;
+        std::cout.flush();
+        replies.clear();
+    }
+
+    // A last line without a newline is answered too
+    if (!stopServing && !pending.empty())
+    {
+        AnswerQuery(*snapshots.Acquire(), pending, replies);
+        std::cout << replies;
+    }
+    std::cout.flush();
+}
+
+int OpenServerSocket(const std::string &socketPath)
+{
+    sockaddr_un address = {};
+    if (socketPath.size() >= sizeof(address.sun_path))
+    {
+        std::cerr << "Socket path is too long: " << socketPath << std::endl;
+        return -1;
+    }
+    address.sun_family = AF_UNIX;
+    std::strncpy(address.sun_path, socketPath.c_str(), sizeof(address.sun_path) - 1);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+    {
+        std::cerr << "Failed to create socket: " << std::strerror(errno) << std::endl;
+        return -1;
+    }
+
+    unlink(socketPath.c_str()); // Remove a socket left behind by a previous run
+    if (bind(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0 || listen(fd, SOMAXCONN) != 0)
+    {
+        std::cerr << "Failed to listen on " << socketPath << ": " << std::strerror(errno) << std::endl;
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// With followConfig, the server swaps to each new version the config names while it runs
+void ServeDictionary(const std::string &serveDictPath, const std::string &socketPath, unsigned threadCount, bool followConfig)
+{
+    // Sorted dictionaries are searched in place unless a hint file is available. Legacy files
+    // get their index loaded into memory, since it can only be scanned.
+    Dictionary::Options options;
+    options.readMode = ReadBackend(IoBackend::Mmap);
+    options.loadIndex = true;
+    options.verifyChecksums = verifyReads;
+    options.cacheBytes = meaningCacheBytes;
+    auto dictionary = Dictionary::Open(serveDictPath, options);
+    if (!dictionary)
+    {
+        std::cerr << "Failed to open dictionary file " << serveDictPath << std::endl;
+        return;
+    }
+    uint32_t entryCount = dictionary->Header().entryCount;
+    DictionarySnapshots snapshots(reclaimVersions);
+    snapshots.Publish(std::move(dictionary));
+
+    std::atomic<bool> stopWatching(false);
+    std::thread watcher;
+    if (followConfig)
+        watcher = std::thread(WatchConfig, std::ref(snapshots), options, std::cref(stopWatching));
+    auto stopWatcher = [&]() {
+        stopWatching = true;
+        if (watcher.joinable())
+            watcher.join();
+    };
+
+    // The cache belongs to the version being served, so a swap starts a new one
+    auto reportCache = [&snapshots]() {
+        std::shared_ptr<const Dictionary> dictionary = snapshots.Acquire();
+        if (MeaningCache *cache = dictionary->Cache())
+        {
+            MeaningCache::Stats stats = cache->Totals();
+            uint64_t lookups = stats.hits + stats.misses;
+            BITCASK_LOG(Info, "Meaning cache: " << stats.hits << " hits, " << stats.misses << " misses ("
+                              << std::fixed << std::setprecision(1) << (lookups ? 100.0 * stats.hits / lookups : 0.0) << "% hit rate), "
+                              << stats.entries << " entries in " << stats.bytes << " bytes, " << stats.evictions << " evictions");
+        }
+    };
+
+    if (socketPath == "-")
+    {
+        // Stdin only: serve until the input ends
+        std::cerr << "Serving " << serveDictPath << " (" << entryCount << " entries) on stdin" << std::endl;
+        ServeStdin(snapshots);
+        stopWatcher();
+        reportCache();
+        return;
+    }
+
+    int listenFd = OpenServerSocket(socketPath);
+    if (listenFd < 0)
+    {
+        stopWatcher();
+        return;
+    }
+
+    struct sigaction action = {};
+    action.sa_handler = HandleServeSignal;
+    sigaction(SIGINT, &action, nullptr);
+    sigaction(SIGTERM, &action, nullptr);
+
+    std::cerr << "Serving " << serveDictPath << " (" << entryCount << " entries) on " << socketPath
+              << " and stdin with " << threadCount << " worker threads" << std::endl;
+
+    // Accepted connections share one epoll set that every worker waits on. A connection is armed
+    // for a single event at a time, so one worker answers it and then re-arms it; any number of
+    // clients can stay connected while the workers only take turns on the ones with input.
+    int epollFd = epoll_create1(EPOLL_CLOEXEC);
+    if (epollFd < 0)
+    {
+        std::cerr << "Failed to create epoll instance: " << std::strerror(errno) << std::endl;
+        close(listenFd);
+        unlink(socketPath.c_str());
+        stopWatcher();
+        return;
+    }
+    std::unordered_map<int, std::unique_ptr<ServeClient>> clients;
+    std::mutex clientsMutex;
+
+    std::vector<std::thread> workers;
+    for (unsigned i = 0; i < threadCount; ++i)
+    {
+        workers.emplace_back([&]() {
+            while (!stopServing)
+            {
+                epoll_event event;
+                if (epoll_wait(epollFd, &event, 1, kServePollIntervalMs) != 1)
+                    continue;
+                ServeClient *client = static_cast<ServeClient *>(event.data.ptr);
+                if (ServeConnection(snapshots, *client))
+                {
+                    event.events = EPOLLIN | EPOLLONESHOT;
+                    if (epoll_ctl(epollFd, EPOLL_CTL_MOD, client->fd, &event) == 0)
+                        continue;
+                }
+                std::lock_guard<std::mutex> lock(clientsMutex);
+                int fd = client->fd;
+                clients.erase(fd);
+                close(fd); // Also leaves the epoll set
+            }
+        });
+    }
+
+    std::thread stdinReader(ServeStdin, std::cref(snapshots));
+
+    while (!stopServing)
+    {
+        pollfd pfd = {listenFd, POLLIN, 0};
+        int ready = poll(&pfd, 1, kServePollIntervalMs);
+        if (ready <= 0)
+            continue;
+
+        int fd = accept4(listenFd, nullptr, nullptr, SOCK_CLOEXEC);
+        if (fd < 0)
+            continue;
+        auto client = std::make_unique<ServeClient>();
+        client->fd = fd;
+        epoll_event event = {};
+        event.events = EPOLLIN | EPOLLONESHOT;
+        event.data.ptr = client.get();
+        std::lock_guard<std::mutex> lock(clientsMutex); // A worker may answer before the client is recorded
+        if (epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event) != 0)
+        {
+            close(fd);
+            continue;
+        }
+        clients[fd] = std::move(client);
+    }
+
+    for (auto &worker : workers)
+        worker.join();
+    stdinReader.join();
+    stopWatcher();
+    for (const auto &client : clients)
+        close(client.first);
+    close(epollFd);
+    close(listenFd);
+    unlink(socketPath.c_str());
+    reportCache();
+    std::cerr << "Server stopped" << std::endl;
+}
+
+// Merging reads each input's sorted index as a stream and combines them with a k-way heap merge,
+// so any number of inputs is merged into one output in a single pass
+const size_t kMergeDataReadAhead = 1024 * 1024; // Bytes of records read at once while an input is read in order
+
+// A sorted stream of entries feeding the merge
+class MergeSource
+{
+public:
+    virtual ~MergeSource() = default;
+    virtual bool Next() = 0; // Advance to the next entry, false once the source is exhausted
+    virtual const std::string &Word() const = 0;
+    virtual bool Deleted() const { return false; }
+    virtual bool WriteRecord(DataSectionWriter &out, uint64_t &location, uint32_t &size) = 0; // Copy the current record, false if it cannot be read
+};
+
+// Entries of a dictionary file. The index is read as a stream and records with positional
+// reads, so walking the index never has to seek back after copying a record.
+class DictionarySource : public MergeSource
+{
+public:
+    bool Open(const std::string &path)
+    {
+        std::ifstream headerFile(path, std::ios::binary);
+        if (!headerFile.is_open() || !dataFile.Open(path, ReadBackend(IoBackend::Pread)))
+            return false;
+        // With --direct, read-ahead over records in key order bypasses the page cache. Records
+        // out of order are single small reads, which O_DIRECT would turn into a device read each.
+        directWindows = directIo && directFile.Open(path, IoBackend::Pread, true);
+        header.ReadFromFile(headerFile);
+        if (!headerFile || (header.HasCompressedBlocks() && !blocks.Load(dataFile, header)))
+            return false;
+        return index.Open(path, header);
+    }
+
+    const BitcaskHeader &Header() const { return header; }
+
+    bool Next() override
+    {
+        if (!index.Next())
+            return false;
+        offset = index.DataOffset();
+        blockSize = index.BlockSize();
+        return true;
+    }
+
+    const std::string &Word() const override { return index.Key(); }
+
+    bool WriteRecord(DataSectionWriter &out, uint64_t &location, uint32_t &size) override
+    {
+        size = blockSize;
+
+        // Records already in the output's format are copied file to file
+        if (out.CanCopyRanges() && !directWindows && dataFile.Descriptor() >= 0 && header.HasCrc32c() && !header.HasCompressedBlocks() &&
+            offset <= dataFile.Size() && blockSize <= dataFile.Size() - offset)
+        {
+            location = out.AppendFrom(dataFile.Descriptor(), offset, blockSize);
+            return true;
+        }
+
+        const char *source = header.HasCompressedBlocks() ? blocks.FetchRecord(dataFile, offset, blockSize) : ReadRecord(offset, blockSize);
+        if (!source)
+        {
+            std::cerr << "Error reading record for '" << index.Key() << "'." << std::endl;
+            return false;
+        }
+
+        // Records from before format version 3 get a CRC32C in place of their byte sum
+        RecordView view;
+        if (!header.HasCrc32c() && ParseRecord(source, blockSize, view))
+        {
+            uint32_t checksum = RecordChecksum(view.word.size(), view.meaning.size(), view.word, view.meaning);
+            record.assign(source, source + blockSize);
+            std::memcpy(record.data(), &checksum, sizeof(checksum));
+            source = record.data();
+        }
+        location = out.Append(source, blockSize);
+        return true;
+    }
+
+private:
+    // A dictionary written by a merge stores its records in key order, so walking the index
+    // walks the data section front to back. Once a record starts where the previous one ended,
+    // records are served from a large window instead of one positional read each.
+    const char *ReadRecord(uint64_t location, uint32_t size)
+    {
+        bool sequential = location == previousEnd;
+        previousEnd = location + size;
+        if (location >= windowStart && location - windowStart <= window.size() && size <= window.size() - (location - windowStart))
+            return window.data() + (location - windowStart);
+        if (!sequential || location >= dataFile.Size())
+            return dataFile.Fetch(location, size, scratch);
+
+        uint64_t length = std::min<uint64_t>(std::max<uint64_t>(kMergeDataReadAhead, size), dataFile.Size() - location);
+        window.resize(length);
+        if (length < size || !(directWindows ? directFile : dataFile).ReadAt(location, length, window.data()))
+        {
+            window.clear();
+            return nullptr;
+        }
+        windowStart = location;
+        return window.data();
     }
 
-    auto start = std::chrono::high_resolution_clock::now(); // Start timing
-
-    // Read the header
+    IndexStream index;
+    FileReader dataFile, directFile;
+    bool directWindows = false;
+    BlockTable blocks;
     BitcaskHeader header;
-    header.ReadFromFile(inFile);
+    std::vector<char> record, scratch, window;
+    uint64_t windowStart = 0;
+    uint64_t previousEnd = UINT64_MAX;
+    uint64_t offset = 0;
+    uint32_t blockSize = 0;
+};
 
-    std::cout << "Read Header:\n";
-    std::cout << "  Version: " << header.version << "\n";
-    std::cout << "  Entry Count: " << header.entryCount << "\n";
-    std::cout << "  Data Offset: " << header.dataOffset << "\n";
-    std::cout << "  Index Offset: " << header.indexOffset << "\n";
+// Latest entries of an active segment, tombstones included
+class SegmentSource : public MergeSource
+{
+public:
+    explicit SegmentSource(const ActiveSegment &segment) : segment(segment), it(segment.Entries().end()) {}
 
-    // If fastRead is enabled, load the index into memory using the global variable
-    if (fastRead)
+    bool Next() override
     {
-        std::cout << "Using fastRead mode. Reading index from memory.\n";
-        if (inMemoryIndex.empty())
-        {
-            std::cerr << "Empty Index \n";
-            return;
-        }
+        it = started ? std::next(it) : segment.Entries().begin();
+        started = true;
+        return it != segment.Entries().end();
+    }
 
-        // Iterate over the in-memory index
-        for (const auto &entry : inMemoryIndex)
-        {
-            const std::string &word = entry.first;
-            uint64_t offset = entry.second.first;
-            uint32_t blockSize = entry.second.second;
+    const std::string &Word() const override { return it->first; }
+    bool Deleted() const override { return it->second.deleted; }
 
-            std::cout << "  Index Entry: Word: '" << word << "', Offset: " << offset << ", Block Size: " << blockSize << "\n";
+    bool WriteRecord(DataSectionWriter &out, uint64_t &location, uint32_t &size) override
+    {
+        size = WriteBitcaskEntry(out, it->first, std::string(segment.MeaningOf(it->second)), location);
+        return true;
+    }
 
-            // Now read the entire data entry at the given offset using block size
-            inFile.seekg(offset); // Move to the word's data section
-            std::vector<char> dataBlock(blockSize);
-            inFile.read(dataBlock.data(), blockSize);
+private:
+    const ActiveSegment &segment;
+    std::map<std::string, ActiveSegment::Entry, std::less<>>::const_iterator it;
+    bool started = false;
+};
 
-            uint32_t checksum, wordSizeInData, meaningSize;
-            std::memcpy(&checksum, dataBlock.data(), sizeof(checksum));
-            std::memcpy(&wordSizeInData, dataBlock.data() + sizeof(checksum), sizeof(wordSizeInData));
-            std::memcpy(&meaningSize, dataBlock.data() + sizeof(checksum) + sizeof(wordSizeInData), sizeof(meaningSize));
+// Merge sorted sources into a new dictionary. When several sources hold the same word the one
+// latest in the list wins, and a winning tombstone drops the word altogether.
+bool MergeSources(std::vector<std::unique_ptr<MergeSource>> &sources, const std::string &outputDictPath, BitcaskHeader &mergedHeader, bool compress, bool perfectHash)
+{
+    std::ofstream mergedFile(outputDictPath, std::ios::binary);
+    if (!mergedFile.is_open())
+    {
+        std::cerr << "Error opening " << outputDictPath << " for writing." << std::endl;
+        return false;
+    }
 
-            std::string wordInData(wordSizeInData, '\0');
-            std::memcpy(&wordInData[0], dataBlock.data() + sizeof(checksum) + sizeof(wordSizeInData) + sizeof(meaningSize), wordSizeInData);
+    mergedFile.seekp(sizeof(BitcaskHeader)); // Reserve space for the header
+    uint64_t dataStart = mergedFile.tellp(); // Data section start
+    BITCASK_LOG(Debug, "Data section starts at: " << dataStart);
+    DataSectionWriter dataWriter(mergedFile, compress);
+    if (!compress)
+        dataWriter.EnableRangeCopy(outputDictPath);
+    if (directIo)
+        dataWriter.EnableWriteBehind(outputDictPath);
 
-            std::string meaning(meaningSize, '\0');
-            std::memcpy(&meaning[0], dataBlock.data() + sizeof(checksum) + sizeof(wordSizeInData) + sizeof(meaningSize) + wordSizeInData, meaningSize);
+    // The heap top is the smallest word, and among equal words the latest source
+    auto laterInHeap = [&sources](size_t a, size_t b) {
+        int cmp = sources[a]->Word().compare(sources[b]->Word());
+        return cmp > 0 || (cmp == 0 && a < b);
+    };
+    std::priority_queue<size_t, std::vector<size_t>, decltype(laterInHeap)> heap(laterInHeap);
+    for (size_t i = 0; i < sources.size(); ++i)
+    {
+        if (sources[i]->Next())
+            heap.push(i);
+    }
 
-            std::cout << "  Data Entry: Word: '" << wordInData << "', Checksum: " << checksum << "\n";
-            std::cout << "  Meaning: '" << meaning << "'\n";
-            std::cout << "  Word Size: " << wordSizeInData << ", Meaning Size: " << meaningSize << "\n";
-        }
+    // Index entries stream to a spill file while records go to the output, and are moved behind
+    // the data section at the end, so memory stays flat however large the inputs are
+    std::string indexSpillPath = outputDictPath + ".index";
+    std::ofstream indexSpill(indexSpillPath, std::ios::binary | std::ios::trunc);
+    if (!indexSpill.is_open())
+    {
+        std::cerr << "Error opening " << indexSpillPath << " for writing." << std::endl;
+        return false;
     }
-    else
+    IndexSectionWriter indexWriter(indexSpill, mergedHeader);
+    while (!heap.empty())
     {
-        // Read and process each index entry without loading them into memory
-        inFile.seekg(header.indexOffset); // Move to the index section
-        std::cout << "Reading Index Entries and Corresponding Data:\n";
+        size_t winner = heap.top();
+        heap.pop();
+        const std::string &word = sources[winner]->Word(); // Stays put until the winner advances
 
-        for (uint32_t i = 0; i < header.entryCount; ++i)
+        if (!sources[winner]->Deleted())
         {
-            uint32_t wordSize;
-            inFile.read(reinterpret_cast<char *>(&wordSize), sizeof(wordSize));
-
-            std::string word(wordSize, '\0');
-            inFile.read(&word[0], wordSize);
-
-            uint64_t offset;
-            inFile.read(reinterpret_cast<char *>(&offset), sizeof(offset));
-
+            uint64_t currentOffset;
             uint32_t blockSize;
-            inFile.read(reinterpret_cast<char *>(&blockSize), sizeof(blockSize));
-
-            std::cout << "  Index Entry: Word: '" << word << "', Offset: " << offset << ", Block Size: " << blockSize << "\n";
-
-            // Now read the data entry at the given offset using block size
-            std::streampos currentPos = inFile.tellg(); // Save current position
-            inFile.seekg(offset);                       // Move to the word's data section
+            if (!sources[winner]->WriteRecord(dataWriter, currentOffset, blockSize))
+            {
+                // An unreadable input record fails the merge instead of publishing a damaged one
+                std::cerr << "Failed to merge into " << outputDictPath << ": an input record could not be read." << std::endl;
+                mergedFile.close();
+                indexSpill.close();
+                std::filesystem::remove(outputDictPath);
+                std::filesystem::remove(indexSpillPath);
+                return false;
+            }
+            indexWriter.Add(word, currentOffset, blockSize);
+        }
 
-            std::vector<char> dataBlock(blockSize);
-            inFile.read(dataBlock.data(), blockSize);
+        // Skip the entries the winner overrides, then move every source involved forward
+        std::vector<size_t> advanced = {winner};
+        while (!heap.empty() && sources[heap.top()]->Word() == word)
+        {
+            advanced.push_back(heap.top());
+            heap.pop();
+        }
+        for (size_t i : advanced)
+        {
+            if (sources[i]->Next())
+                heap.push(i);
+        }
+    }
 
-            uint32_t checksum, wordSizeInData, meaningSize;
-            std::memcpy(&checksum, dataBlock.data(), sizeof(checksum));
-            std::memcpy(&wordSizeInData, dataBlock.data() + sizeof(checksum), sizeof(wordSizeInData));
-            std::memcpy(&meaningSize, dataBlock.data() + sizeof(checksum) + sizeof(wordSizeInData), sizeof(meaningSize));
+    if (!dataWriter.Finish())
+    {
+        std::cerr << "Failed to write the data section of " << outputDictPath << std::endl;
+        indexSpill.close();
+        std::filesystem::remove(indexSpillPath);
+        return false;
+    }
 
-            std::string wordInData(wordSizeInData, '\0');
-            std::memcpy(&wordInData[0], dataBlock.data() + sizeof(checksum) + sizeof(wordSizeInData) + sizeof(meaningSize), wordSizeInData);
+    // Write the index section
+    BITCASK_LOG(Debug, "Index section starts at: " << mergedFile.tellp());
+    bool indexMoved = indexWriter.MoveEntriesTo(mergedFile, indexSpillPath);
+    indexSpill.close();
+    std::filesystem::remove(indexSpillPath);
+    if (!indexMoved || !indexWriter.Finish(outputDictPath))
+    {
+        std::cerr << "Failed to write the index of " << outputDictPath << std::endl;
+        return false;
+    }
+    WriteFilterSection(mergedFile, outputDictPath, mergedHeader);
+    if (perfectHash)
+        WritePerfectHashSection(mergedFile, outputDictPath, mergedHeader);
+    dataWriter.WriteBlockTable(mergedHeader);
 
-            std::string meaning(meaningSize, '\0');
-            std::memcpy(&meaning[0], dataBlock.data() + sizeof(checksum) + sizeof(wordSizeInData) + sizeof(meaningSize) + wordSizeInData, meaningSize);
+    // Update header with correct offsets and write it
+    mergedHeader.dataOffset = dataStart;
+    mergedFile.seekp(0);
+    mergedHeader.WriteToFile(mergedFile);
+    mergedFile.close();
+    if (!mergedFile)
+    {
+        std::cerr << "Failed to write " << outputDictPath << std::endl;
+        return false;
+    }
+    BITCASK_LOG(Info, "Header written with index offset: " << mergedHeader.indexOffset
+                      << ", data offset: " << mergedHeader.dataOffset
+                      << ", entry count: " << mergedHeader.entryCount);
 
-            std::cout << "  Data Entry: Word: '" << wordInData << "', Checksum: " << checksum << "\n";
-            std::cout << "  Meaning: '" << meaning << "'\n";
-            std::cout << "  Word Size: " << wordSizeInData << ", Meaning Size: " << meaningSize << "\n";
+    WriteHintFile(outputDictPath, mergedHeader);
+    return true;
+}
 
-            inFile.seekg(currentPos); // Return to the position after reading the index entry
+// Outputs are truncated before the inputs are read, so no output may be one of them
+bool OutputIsAnInput(const std::string &outputPath, const std::vector<std::string> &inputPaths)
+{
+    for (const auto &inputPath : inputPaths)
+    {
+        std::error_code error;
+        if (std::filesystem::equivalent(outputPath, inputPath, error))
+        {
+            std::cerr << "Cannot write " << outputPath << " over one of its own inputs; choose another output path." << std::endl;
+            return true;
         }
     }
-
-    auto end = std::chrono::high_resolution_clock::now(); // End timing
-    std::chrono::duration<double> elapsed = end - start;
-    std::cout << "Time taken to read dictionary: " << std::fixed << std::setprecision(6) << elapsed.count() << " seconds." << std::endl;
-    inFile.close();
+    return false;
 }
 
-
-std::pair<uint64_t, uint32_t> FindWordInBitcask(const std::string &word, std::ifstream &inFile, const BitcaskHeader &header)
+// Entries of another source that route to one shard, for merging into a different shard layout
+class ShardFilterSource : public MergeSource
 {
-    auto start = std::chrono::high_resolution_clock::now(); // Start timing
-
-    uint64_t dataOffset = 0;
-    uint32_t meaningSize = 0;
-    bool wordFound = false; // Flag to determine if the word was found
+public:
+    ShardFilterSource(std::unique_ptr<MergeSource> source, uint32_t shard, uint32_t shardCount)
+        : source(std::move(source)), shard(shard), shardCount(shardCount) {}
 
-    if (fastRead)
+    bool Next() override
     {
-        if (inMemoryIndex.empty())
+        while (source->Next())
         {
-            std::cerr << "Empty Index \n";
-            return {0, 0};
+            if (ShardOf(source->Word(), shardCount) == shard)
+                return true;
         }
-        
-        // Use the in-memory index to find the word offset and block size
-        auto it = inMemoryIndex.find(word);
-        if (it != inMemoryIndex.end())
-        {
-            dataOffset = it->second.first;
-            uint32_t blockSize = it->second.second;
+        return false;
+    }
 
-            inFile.seekg(dataOffset, std::ios::beg);
-            std::vector<char> dataBlock(blockSize);
-            inFile.read(dataBlock.data(), blockSize);
+    const std::string &Word() const override { return source->Word(); }
+    bool Deleted() const override { return source->Deleted(); }
+    bool WriteRecord(DataSectionWriter &out, uint64_t &location, uint32_t &size) override { return source->WriteRecord(out, location, size); }
 
-            uint32_t checksum, readWordSize;
-            std::memcpy(&checksum, dataBlock.data(), sizeof(checksum));
-            std::memcpy(&readWordSize, dataBlock.data() + sizeof(checksum), sizeof(readWordSize));
-            std::memcpy(&meaningSize, dataBlock.data() + sizeof(checksum) + sizeof(readWordSize), sizeof(meaningSize));
+private:
+    std::unique_ptr<MergeSource> source;
+    uint32_t shard, shardCount;
+};
 
-            // Calculate the offset to the meaning in the data block
-            dataOffset += sizeof(checksum) + sizeof(readWordSize) + sizeof(meaningSize) + readWordSize;
-            wordFound = true;
+// Merge inputs, each given as its shard files and in increasing precedence, and optionally an
+// active segment on top, into shardCount output shards. An input already split into shardCount
+// shards feeds only the matching output shard; any other input is filtered down to each output
+// shard's words. Output shards are merged in parallel, each a single-pass k-way merge.
+bool MergeIntoShards(const std::vector<std::vector<std::string>> &inputs, const ActiveSegment *segment, const std::string &outputDictPath,
+                     uint32_t outputVersion, bool compress, bool perfectHash, uint32_t shardCount, unsigned threadCount, ShardManifest &output)
+{
+    std::vector<BitcaskHeader> headers(shardCount, BitcaskHeader{outputVersion, 0, 0, 0});
+    std::vector<std::string> outputPaths(shardCount, outputDictPath);
+    for (uint32_t shard = 0; shard < shardCount && shardCount > 1; ++shard)
+        outputPaths[shard] = ShardPathFor(outputDictPath, shard);
+    for (const auto &outputPath : outputPaths)
+    {
+        for (const auto &files : inputs)
+        {
+            if (OutputIsAnInput(outputPath, files))
+                return false;
         }
     }
-    else
-    {
-        inFile.seekg(header.indexOffset);
 
-        // Iterate through each entry in the index section
-        for (uint32_t i = 0; i < header.entryCount; ++i)
+    std::vector<char> merged(shardCount, 0);
+    RunParallel(shardCount, std::min(threadCount, shardCount), [&](size_t shard) {
+        auto route = [&](std::unique_ptr<MergeSource> source, bool aligned) -> std::unique_ptr<MergeSource> {
+            if (aligned || shardCount == 1)
+                return source;
+            return std::make_unique<ShardFilterSource>(std::move(source), static_cast<uint32_t>(shard), shardCount);
+        };
+        std::vector<std::unique_ptr<MergeSource>> sources;
+        for (const auto &files : inputs)
         {
-            uint32_t wordSize;
-            inFile.read(reinterpret_cast<char *>(&wordSize), sizeof(wordSize));
-            if (inFile.fail())
+            bool aligned = files.size() == shardCount;
+            for (size_t i = 0; i < files.size(); ++i)
             {
-                std::cerr << "Error reading word size from index." << std::endl;
-                inFile.clear();
-                break;
+                if (aligned && i != shard)
+                    continue;
+                auto source = std::make_unique<DictionarySource>();
+                if (!source->Open(files[i]))
+                {
+                    std::cerr << "Error opening Bitcask file " << files[i] << std::endl;
+                    return;
+                }
+                sources.push_back(route(std::move(source), aligned));
             }
+        }
+        if (segment)
+            sources.push_back(route(std::make_unique<SegmentSource>(*segment), false));
 
-            std::string storedWord(wordSize, '\0');
-            inFile.read(&storedWord[0], wordSize);
-            if (inFile.fail())
+        merged[shard] = MergeSources(sources, outputPaths[shard], headers[shard], compress, perfectHash);
+    });
+    if (std::find(merged.begin(), merged.end(), 0) != merged.end())
+    {
+        // Nothing is published, so the shards that did finish are removed as well
+        for (uint32_t shard = 0; shard < shardCount; ++shard)
+        {
+            if (merged[shard])
             {
-                std::cerr << "Error reading word from index." << std::endl;
-                inFile.clear();
-                break;
+                std::filesystem::remove(outputPaths[shard]);
+                std::filesystem::remove(HintPathFor(outputPaths[shard]));
             }
+        }
+        return false;
+    }
 
-            inFile.read(reinterpret_cast<char *>(&dataOffset), sizeof(dataOffset));
-            if (inFile.fail())
-            {
-                std::cerr << "Error reading data offset from index." << std::endl;
-                inFile.clear();
-                break;
-            }
+    output = ShardManifest();
+    output.version = outputVersion;
+    for (uint32_t shard = 0; shard < shardCount; ++shard)
+    {
+        output.entryCount += headers[shard].entryCount;
+        output.shardPaths.push_back(outputPaths[shard]);
+    }
+    if (shardCount > 1 && !WriteShardManifest(outputDictPath, output))
+    {
+        std::cerr << "Failed to write the shard manifest " << outputDictPath << ": " << std::strerror(errno) << std::endl;
+        return false;
+    }
+    return true;
+}
 
-            uint32_t blockSize;
-            inFile.read(reinterpret_cast<char *>(&blockSize), sizeof(blockSize));
-            if (inFile.fail())
+// Merge any number of dictionaries into one; for repeated words the later input wins. The
+// output keeps the largest shard count among the inputs unless --shards asks for another.
+bool MergeDictionary(const std::vector<std::string> &inputPaths, const std::string &outputDictPath, unsigned threadCount)
+{
+    std::vector<std::vector<std::string>> inputs;
+    uint32_t newestVersion = 0, shardCount = std::max(1u, dictionaryShards);
+    bool compress = compressData; // Compressed inputs keep the output compressed
+    bool perfectHash = buildPerfectHash; // And so does a perfect hash
+    for (const auto &inputPath : inputPaths)
+    {
+        inputs.push_back(DictionaryShardFiles(inputPath));
+        for (const auto &file : inputs.back())
+        {
+            DictionarySource source;
+            if (!source.Open(file))
             {
-                std::cerr << "Error reading block size from index." << std::endl;
-                inFile.clear();
-                break;
+                std::cerr << "Error opening Bitcask file " << file << std::endl;
+                return false;
             }
-
-            if (storedWord == word)
+            if (!source.Header().HasSortedIndex())
             {
-                inFile.seekg(dataOffset, std::ios::beg);
-                std::vector<char> dataBlock(blockSize);
-                inFile.read(dataBlock.data(), blockSize);
-
-                uint32_t checksum, readWordSize;
-                std::memcpy(&checksum, dataBlock.data(), sizeof(checksum));
-                std::memcpy(&readWordSize, dataBlock.data() + sizeof(checksum), sizeof(readWordSize));
-                std::memcpy(&meaningSize, dataBlock.data() + sizeof(checksum) + sizeof(readWordSize), sizeof(meaningSize));
-
-                // Calculate the offset to the meaning in the data block
-                dataOffset += sizeof(checksum) + sizeof(readWordSize) + sizeof(meaningSize) + readWordSize;
-                wordFound = true;
-                break; // Exit loop since the word is found
+                std::cerr << "Warning: " << file << " is a legacy dictionary whose index may be unsorted; rebuild it with --create-dict first." << std::endl;
             }
+            newestVersion = std::max(newestVersion, source.Header().version);
+            compress = compress || source.Header().HasCompressedBlocks();
+            perfectHash = perfectHash || source.Header().HasPerfectHash();
         }
+        if (dictionaryShards == 0)
+            shardCount = std::max(shardCount, static_cast<uint32_t>(inputs.back().size()));
     }
 
-    auto end = std::chrono::high_resolution_clock::now(); // End timing
-    std::chrono::duration<double> elapsed = end - start;
-    
-    std::cout << "Time taken to search dictionary: " << std::fixed << std::setprecision(6) << elapsed.count() << " seconds." << std::endl;
+    // One version bump for the whole merge
+    ShardManifest merged;
+    if (!MergeIntoShards(inputs, nullptr, outputDictPath, newestVersion + 1, compress, perfectHash, shardCount, threadCount, merged))
+        return false;
+
+    // Update dictionary path and version in the config file
+    dictPath = outputDictPath;
+    version = std::to_string(merged.version);
+    SaveConfig();
 
-    if (wordFound)
-    {
-        return {dataOffset, meaningSize}; // Return the offset and size of the meaning
-    }
-    else
+    // Debug Output
+    uint64_t mergedSize = 0;
+    for (const auto &shardPath : merged.shardPaths)
+        mergedSize += std::filesystem::file_size(shardPath);
+    BITCASK_LOG(Info, "Merged Dictionary Size: " << mergedSize << " bytes" << (shardCount > 1 ? " in " + std::to_string(shardCount) + " shards" : ""));
+    BITCASK_LOG(Info, "Entries Merged: " << merged.entryCount << " from " << inputPaths.size() << " dictionaries");
+    return true;
+}
+
+// Append a put for every row of a CSV, or a single put or delete, to the dictionary's active segment
+bool OpenSegmentForWrite(const std::string &targetDictPath, const SyncOptions &syncOptions, ActiveSegment &segment)
+{
+    if (!std::filesystem::exists(targetDictPath))
     {
-        std::cout << "Word not found: " << word << std::endl;
-        return {0, 0}; // Not found
+        std::cerr << "Dictionary " << targetDictPath << " does not exist; create it with --create-dict first." << std::endl;
+        return false;
     }
+    return segment.OpenForAppend(targetDictPath, syncOptions);
 }
 
+void PutWord(const std::string &word, const std::string &meaning, const std::string &targetDictPath, const SyncOptions &syncOptions)
+{
+    ActiveSegment segment;
+    if (OpenSegmentForWrite(targetDictPath, syncOptions, segment) && segment.Put(word, meaning))
+        BITCASK_LOG(Info, "Stored '" << word << "' in " << segment.Path());
+}
 
-void SearchWord(const std::string &word, const std::string &searchDictPath)
+void DeleteWord(const std::string &word, const std::string &targetDictPath, const SyncOptions &syncOptions)
+{
+    ActiveSegment segment;
+    if (OpenSegmentForWrite(targetDictPath, syncOptions, segment) && segment.Delete(word))
+        BITCASK_LOG(Info, "Deleted '" << word << "' in " << segment.Path());
+}
+
+void ApplyCSV(const std::string &csvFilePath, const std::string &targetDictPath, const SyncOptions &syncOptions)
 {
-    std::ifstream inFile(searchDictPath, std::ios::binary);
+    std::ifstream inFile(csvFilePath);
     if (!inFile.is_open())
     {
-        std::cout << "Failed to open dictionary file." << std::endl;
+        std::cerr << "Failed to open " << csvFilePath << std::endl;
         return;
     }
 
-    BitcaskHeader header;
-    header.ReadFromFile(inFile); // Read the header to get index and data offsets
+    ActiveSegment segment;
+    if (!OpenSegmentForWrite(targetDictPath, syncOptions, segment))
+        return;
 
-    auto [pos, meaningSize] = FindWordInBitcask(word, inFile, header);
-    if (pos != 0)
+    std::string line;
+    size_t applied = 0;
+    while (std::getline(inFile, line))
     {
-        inFile.seekg(pos); // Go to meaning position
-        std::string meaning(meaningSize, '\0');
-        inFile.read(&meaning[0], meaningSize);
-        if (inFile.fail())
-        {
-            std::cerr << "Error reading meaning from data section." << std::endl;
-        }
-        else
+        std::istringstream ss(line);
+        std::string word, meaning;
+        if (std::getline(ss, word, ',') && std::getline(ss, meaning))
         {
-            std::cout << word << ": " << meaning << std::endl;
+            if (!segment.Put(word, meaning))
+                break;
+            applied++;
         }
     }
-    else
-    {
-        std::cout << "Word not found: " << word << std::endl;
-    }
-
-    inFile.close();
+    BITCASK_LOG(Info, "Applied " << applied << " entries from " << csvFilePath << " to " << segment.Path());
 }
 
-void MergeDictionary(const std::string &dict1Path, const std::string &dict2Path, const std::string &outputDictPath)
+// Fold the active segment into a new dictionary version: a merge of the dictionary with its
+// segment, where segment records replace or delete the dictionary's. The segment is removed after.
+// An empty output path names the result after its new version.
+bool CompactDictionary(const std::string &baseDictPath, const std::string &outputPath, unsigned threadCount)
 {
-    std::ifstream dict1(dict1Path, std::ios::binary);
-    std::ifstream dict2(dict2Path, std::ios::binary);
-    std::ofstream mergedFile(outputDictPath, std::ios::binary);
-
-    if (!dict1.is_open() || !dict2.is_open() || !mergedFile.is_open())
-    {
-        std::cerr << "Error opening one of the Bitcask files." << std::endl;
-        return;
-    }
-
-    // Read headers from both dictionaries
-    BitcaskHeader header1, header2;
-    header1.ReadFromFile(dict1);
-    header2.ReadFromFile(dict2);
-
-    // Reserve space for the header in the merged file
-    BitcaskHeader mergedHeader = {header1.version + 1, 0, 0, 0}; // Increment version for the merged dictionary
-    mergedFile.seekp(sizeof(BitcaskHeader));                     // Reserve space for the header
-    std::cout << "Reserved space for header: " << sizeof(BitcaskHeader) << " bytes" << std::endl;
-
-    uint64_t dataStart = mergedFile.tellp(); // Data section start
-    std::cout << "Data section starts at: " << dataStart << std::endl;
-
-    // Set up reading from the index sections of both dictionaries
-    dict1.seekg(header1.indexOffset);
-    dict2.seekg(header2.indexOffset);
-
-    // Storage for the merged index
-    std::vector<std::tuple<std::string, uint64_t, uint32_t>> index; // Include block size
-
-    // Read the first entries from both dictionaries
-    std::string word1, word2;
-    uint64_t offset1 = 0, offset2 = 0;
-    uint32_t blockSize1 = 0, blockSize2 = 0;
-    bool valid1 = header1.entryCount > 0; // Flags to check validity
-    bool valid2 = header2.entryCount > 0;
-
-    auto readNextEntry = [](std::ifstream &file, std::string &word, uint64_t &offset, uint32_t &blockSize) -> bool {
-        uint32_t wordSize;
-        if (!file.read(reinterpret_cast<char *>(&wordSize), sizeof(wordSize)))
-            return false;
-        word.resize(wordSize);
-        if (!file.read(&word[0], wordSize))
-            return false;
-        if (!file.read(reinterpret_cast<char *>(&offset), sizeof(offset)))
-            return false;
-        if (!file.read(reinterpret_cast<char *>(&blockSize), sizeof(blockSize)))
-            return false;
-        return true;
-    };
-
-    if (valid1)
-        valid1 = readNextEntry(dict1, word1, offset1, blockSize1);
-
-    if (valid2)
-        valid2 = readNextEntry(dict2, word2, offset2, blockSize2);
+    // Held until the segment is removed, so no put lands in a segment this has already read
+    ActiveSegment segment;
+    if (!segment.LockAndLoad(baseDictPath))
+        return false;
 
-    // Continue reading while at least one dictionary has valid entries
-    while (valid1 || valid2)
+    std::vector<std::string> files = DictionaryShardFiles(baseDictPath);
+    uint32_t baseVersion = 0;
+    bool compress = compressData, perfectHash = buildPerfectHash;
+    for (const auto &file : files)
     {
-        if (valid1 && (!valid2 || (valid2 && word1 < word2)))
-        {
-            // Write the entry from the first dictionary
-            uint64_t currentOffset = mergedFile.tellp(); // Store the current offset before writing
-            std::streampos currentPos = dict1.tellg();   // Save current position
-            std::vector<char> dataBlock(blockSize1);
-            dict1.seekg(offset1); // Move to the word's data section in dict1
-            dict1.read(dataBlock.data(), blockSize1);
-            mergedFile.write(dataBlock.data(), blockSize1);
-
-            // Store the index entry in memory with block size
-            index.push_back({word1, currentOffset, blockSize1});
-            mergedHeader.entryCount++;
-
-            dict1.seekg(currentPos); // Return to position after reading the index entry
-            // Move to the next entry in dict1
-            valid1 = readNextEntry(dict1, word1, offset1, blockSize1);
-        }
-        else if (valid2 && (!valid1 || (valid1 && word2 < word1)))
+        DictionarySource base;
+        if (!base.Open(file))
         {
-            // Write the entry from the second dictionary
-            uint64_t currentOffset = mergedFile.tellp(); // Store the current offset before writing
-            std::streampos currentPos = dict2.tellg();   // Save current position
-            std::vector<char> dataBlock(blockSize2);
-            dict2.seekg(offset2); // Move to the word's data section in dict2
-            dict2.read(dataBlock.data(), blockSize2);
-            mergedFile.write(dataBlock.data(), blockSize2);
-
-            // Store the index entry in memory with block size
-            index.push_back({word2, currentOffset, blockSize2});
-            mergedHeader.entryCount++;
-
-            dict2.seekg(currentPos); // Return to position after reading the index entry
-            // Move to the next entry in dict2
-            valid2 = readNextEntry(dict2, word2, offset2, blockSize2);
+            std::cerr << "Error opening " << file << std::endl;
+            return false;
         }
-        else if (valid1 && valid2 && word1 == word2)
+        if (!base.Header().HasSortedIndex())
         {
-            // Replace the entry from the first dictionary with the second dictionary's entry
-            uint64_t currentOffset = mergedFile.tellp();    // Store the current offset before writing
-            std::streampos currentPosDict1 = dict1.tellg(); // Save current position in dict1
-            std::streampos currentPosDict2 = dict2.tellg(); // Save current position in dict2
-            std::vector<char> dataBlock(blockSize2);
-            dict2.seekg(offset2); // Prefer the second dictionary's data
-            dict2.read(dataBlock.data(), blockSize2);
-            mergedFile.write(dataBlock.data(), blockSize2);
-
-            // Store the index entry in memory with block size
-            index.push_back({word2, currentOffset, blockSize2});
-            mergedHeader.entryCount++;
-
-            dict1.seekg(currentPosDict1); // Return to position after reading the index entry in dict1
-            dict2.seekg(currentPosDict2); // Return to position after reading the index entry in dict2
-
-            // Move to the next entries in both dict1 and dict2
-            valid1 = readNextEntry(dict1, word1, offset1, blockSize1);
-            valid2 = readNextEntry(dict2, word2, offset2, blockSize2);
+            std::cerr << "Cannot compact a legacy dictionary with an unsorted index; rebuild it with --create-dict first." << std::endl;
+            return false;
         }
+        baseVersion = std::max(baseVersion, base.Header().version);
+        compress = compress || base.Header().HasCompressedBlocks();
+        perfectHash = perfectHash || base.Header().HasPerfectHash();
     }
 
-    // Write the index section
-    uint64_t indexStart = mergedFile.tellp();
-    std::cout << "Index section starts at: " << indexStart << std::endl;
-
-    for (const auto &entry : index)
-    {
-        uint32_t wordSize = std::get<0>(entry).size();
-        mergedFile.write(reinterpret_cast<const char *>(&wordSize), sizeof(wordSize));
-        mergedFile.write(std::get<0>(entry).c_str(), wordSize);
-        mergedFile.write(reinterpret_cast<const char *>(&std::get<1>(entry)), sizeof(uint64_t)); // Offset
-        mergedFile.write(reinterpret_cast<const char *>(&std::get<2>(entry)), sizeof(uint32_t)); // Block size
-        std::cout << "Wrote index entry for word: '" << std::get<0>(entry) << "' at offset: " << std::get<1>(entry) << " with block size: " << std::get<2>(entry) << std::endl;
-    }
-
-    // Update header with correct offsets and write it
-    mergedHeader.indexOffset = indexStart;
-    mergedHeader.dataOffset = dataStart;
-    mergedHeader.entryCount = static_cast<uint32_t>(index.size());
-    mergedFile.seekp(0);
-    mergedHeader.WriteToFile(mergedFile);
-    std::cout << "Header written with index offset: " << mergedHeader.indexOffset
-              << ", data offset: " << mergedHeader.dataOffset
-              << ", entry count: " << mergedHeader.entryCount << std::endl;
+    std::string outputDictPath = outputPath.empty() ? "dictionary_" + std::to_string(baseVersion + 1) + ".bitcask" : outputPath;
+    if (OutputIsAnInput(outputDictPath, {baseDictPath}))
+        return false;
+    uint32_t shardCount = dictionaryShards != 0 ? dictionaryShards : static_cast<uint32_t>(files.size());
+    ShardManifest compacted;
+    if (!MergeIntoShards({files}, &segment, outputDictPath, baseVersion + 1, compress, perfectHash, shardCount, threadCount, compacted))
+        return false;
 
-    dict1.close();
-    dict2.close();
-    mergedFile.close();
+    // The new version holds everything the segment did
+    std::filesystem::remove(segment.Path());
 
-    // Update dictionary path and version in the config file
     dictPath = outputDictPath;
-    version = std::to_string(mergedHeader.version);
-    std::ofstream configOut(configPath);
-    configOut << "path=" << dictPath << "\nversion=" << version << "\n";
-    configOut.close();
-
-    // Debug Output
-    std::cout << "Merged Dictionary Size: " << std::filesystem::file_size(outputDictPath) << " bytes" << std::endl;
-    std::cout << "Entries Merged: " << mergedHeader.entryCount << std::endl;
+    version = std::to_string(compacted.version);
+    SaveConfig();
+    BITCASK_LOG(Info, "Compacted " << segment.Entries().size() << " segment entries into " << outputDictPath
+                      << " (" << compacted.entryCount << " entries)");
+    return true;
 }
 
 // Merges two large CSV files line by line, replacing old meanings with new ones
@@ -664,91 +6169,223 @@ void CreateDefaultConfig()
 {
     dictPath = "dictionary_1.bitcask";
     version = "1";
-    std::ofstream configOut(configPath);
-    configOut << "path=" << dictPath << "\nversion=" << version << "\n";
-    configOut.close();
+    SaveConfig();
 }
 
+// bitcask_bench.cpp includes this file with BITCASK_NO_MAIN defined to drive the engine directly
+#ifndef BITCASK_NO_MAIN
 int main(int argc, char *argv[])
 {
+    // Nothing uses C stdio, so the streams can keep their own buffers; std::clog needs one for trace output
+    std::ios::sync_with_stdio(false);
+
     // Try to read the config file
-    std::ifstream configIn(configPath);
-    if (configIn.is_open())
-    {
-        std::getline(configIn, dictPath, '=');
-        std::getline(configIn, dictPath);
-        std::getline(configIn, version, '=');
-        std::getline(configIn, version);
-        configIn.close();
-    }
-    else
+    if (!LoadConfig(configPath, dictPath, version))
     {
         std::cerr << "Config file not found. Creating default config.\n";
         CreateDefaultConfig(); // Create default config if not present
     }
+    uint64_t configVersion;
+    if (!ParseCount(version, INT32_MAX - 1, configVersion))
+    {
+        std::cerr << "Invalid version '" << version << "' in " << configPath << "\n";
+        return 1;
+    }
 
+    // Pull the mode flags out of the arguments so they can appear anywhere on the command line
+    std::vector<std::string> args(argv, argv + argc);
+    auto extractFlag = [&args](const std::string &flag) -> bool {
+        auto it = std::find(args.begin(), args.end(), flag);
+        if (it == args.end())
+            return false;
+        args.erase(it);
+        return true;
+    };
+    auto extractOption = [&args](const std::string &option, const std::string &defaultValue) -> std::string {
+        auto it = std::find(args.begin(), args.end(), option);
+        if (it == args.end() || std::next(it) == args.end())
+            return defaultValue;
+        std::string value = *std::next(it);
+        args.erase(it, std::next(it, 2));
+        return value;
+    };
+    fastRead = extractFlag("--fast-read");
+    if (extractFlag("--mmap"))
+        ioBackend = IoBackend::Mmap;
+    if (extractFlag("--pread"))
+        ioBackend = IoBackend::Pread;
+    directIo = extractFlag("--direct");
+    verifyReads = extractFlag("--verify-checksums");
+    compressData = extractFlag("--compress");
+    buildPerfectHash = extractFlag("--perfect-hash");
+    statsEnabled = extractFlag("--stats");
+    reclaimVersions = extractFlag("--reclaim");
+    std::string socketPath = extractOption("--socket", "dictionary.sock");
+    std::string syncOption = extractOption("--sync", "1000ms");
+    std::string threadOption = extractOption("--threads", std::to_string(std::clamp(std::thread::hardware_concurrency(), 1u, kMaxThreads)));
+    std::string limitOption = extractOption("--limit", "0");
+    std::string filterOption = extractOption("--bloom-fp", "0.01");
+    std::string logLevelOption = extractOption("--log-level", "info");
+    std::string sortMemoryOption = extractOption("--sort-memory", "1024");
+    std::string cacheOption = extractOption("--cache", "0");
+    std::string shardsOption = extractOption("--shards", "0");
+    std::string ioOption = extractOption("--io", "");
+    argc = static_cast<int>(args.size());
     if (argc < 2)
     {
-        std::cerr << "Usage: " << argv[0] << " --create-dict <csv> [output_path] | --search <word> [dict_path] | --update-dict <bitcask> | --merge-csv <csv1> <csv2> <output_csv> | --merge-dict <dict1> <dict2> <output_path> | --read-dict [dict_path] | --fast-read\n";
+        std::cerr << "Usage: " << argv[0] << " --create-dict <csv> [output_path] | --search <word> [dict_path] | --search-batch <file|-> [dict_path] | --prefix <prefix> [dict_path] [--limit <n>] | --range <from> <to> [dict_path] [--limit <n>] | --put <word> <meaning> [dict_path] | --delete <word> [dict_path] | --apply-csv <csv> [dict_path] | --compact [dict_path] [output_path] | --merge-csv <csv1> <csv2> <output_csv> | --merge-dict <dict1> <dict2> [<dict3> ...] <output_path> | --read-dict [dict_path] [--threads <n>] | --export-csv <csv|-> [dict_path] [--threads <n>] | --verify-dict [dict_path] [--threads <n>] | --serve [dict_path] [--socket <path>] [--threads <n>] [--pread] [--cache <MB>] [--reclaim] | --fast-read | --io stream|pread|mmap|uring | --mmap | --direct | --verify-checksums | --compress | --perfect-hash | --bloom-fp <rate> | --sort-memory <MB> | --shards <n> | --log-level error|warn|info|debug|trace | --stats\n";
         return 1;
     }
 
-    // Check if fastRead flag is present in arguments and adjust argc/argv accordingly
-    std::vector<std::string> args(argv, argv + argc);
-    auto it = std::find(args.begin(), args.end(), "--fast-read");
-    if (it != args.end())
+    std::string command = args[1];
+
+    char *filterEnd = nullptr;
+    filterFalsePositiveRate = std::strtod(filterOption.c_str(), &filterEnd);
+    if (filterOption.empty() || *filterEnd != '\0' || !(filterFalsePositiveRate >= 0 && filterFalsePositiveRate < 1))
     {
-        fastRead = true;
-        args.erase(it); // Remove the --fast-read argument
-        argc--;         // Adjust argument count
+        std::cerr << "Invalid --bloom-fp value '" << filterOption << "', expected a rate in [0, 1)\n";
+        return 1;
     }
 
-    std::string command = argv[1];
+    // Numeric options are checked once here, so a bad value is a usage error rather than an uncaught exception
+    auto parseCountOption = [](const char *option, const std::string &value, uint64_t max, uint64_t &count) {
+        if (ParseCount(value, max, count))
+            return true;
+        std::cerr << "Invalid " << option << " value '" << value << "', expected a whole number";
+        if (max != UINT64_MAX)
+            std::cerr << " of at most " << max;
+        std::cerr << "\n";
+        return false;
+    };
+    uint64_t threadCount, scanLimit, sortMemoryMb, cacheMb, shardCount;
+    if (!parseCountOption("--threads", threadOption, kMaxThreads, threadCount) ||
+        !parseCountOption("--limit", limitOption, UINT64_MAX, scanLimit) ||
+        !parseCountOption("--sort-memory", sortMemoryOption, SIZE_MAX >> 20, sortMemoryMb) ||
+        !parseCountOption("--cache", cacheOption, SIZE_MAX >> 20, cacheMb) ||
+        !parseCountOption("--shards", shardsOption, kMaxShards, shardCount))
+        return 1;
+    const unsigned threads = std::max<unsigned>(1, static_cast<unsigned>(threadCount));
+    sortMemoryBudget = static_cast<size_t>(sortMemoryMb) * 1024 * 1024;
+    meaningCacheBytes = static_cast<size_t>(cacheMb) * 1024 * 1024;
+    dictionaryShards = static_cast<uint32_t>(shardCount);
 
-    if (fastRead && (command == "--search" || command == "--read-dict"))
+    IoBackend selectedBackend;
+    if (!ioOption.empty())
     {
-        // Determine the correct path to load the index from
-        std::string dictPathToLoad;
-        if (command == "--search" && (argc == 3 || argc == 4))
-        {
-            dictPathToLoad = (argc == 4) ? argv[3] : dictPath;
-        }
-        else if (command == "--read-dict" && (argc == 2 || argc == 3))
+        if (!ParseIoBackend(ioOption, selectedBackend))
         {
-            dictPathToLoad = (argc == 3) ? argv[2] : dictPath;
+            std::cerr << "Invalid --io value '" << ioOption << "', expected stream, pread, mmap or uring\n";
+            return 1;
         }
+        ioBackend = selectedBackend;
+    }
 
-        // Load index into memory if fastRead is enabled
-        if (!dictPathToLoad.empty())
-        {
-            LoadIndex(dictPathToLoad);
-            std::cout << "Fast read mode enabled and index loaded from: " << dictPathToLoad << std::endl;
-        }
+    if (!ParseLogLevel(logLevelOption, logLevel))
+    {
+        std::cerr << "Invalid --log-level value '" << logLevelOption << "', expected error, warn, info, debug or trace\n";
+        return 1;
+    }
+
+    SyncOptions syncOptions;
+    if (!ParseSyncOptions(syncOption, syncOptions))
+    {
+        std::cerr << "Invalid --sync value '" << syncOption << "', expected always, never or <N>ms\n";
+        return 1;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    int status = 0;
+
+    // Lookups load their index when the dictionary is opened, while --read-dict iterates the in-memory index
+    ShardManifest manifest;
+    if (fastRead && command == "--read-dict" && (argc == 2 || argc == 3) && !ReadShardManifest((argc == 3) ? args[2] : dictPath, manifest))
+    {
+        std::string dictPathToLoad = (argc == 3) ? args[2] : dictPath;
+        LoadIndex(dictPathToLoad);
+        BITCASK_LOG(Info, "Fast read mode enabled and index loaded from: " << dictPathToLoad);
     }
 
     if (command == "--create-dict" && (argc == 3 || argc == 4))
     {
         // Use output path from command line if provided, otherwise use config path
-        std::string outputPath = (argc == 4) ? argv[3] : dictPath;
-        CreateDictionary(argv[2], outputPath);
+        std::string outputPath = (argc == 4) ? args[3] : dictPath;
+        if (!CreateDictionary(args[2], outputPath, threads))
+            status = 1;
     }
     else if (command == "--search" && (argc == 3 || argc == 4))
     {
-        std::string searchDictPath = (argc == 4) ? argv[3] : dictPath;
-        SearchWord(argv[2], searchDictPath);
+        std::string searchDictPath = (argc == 4) ? args[3] : dictPath;
+        SearchWord(args[2], searchDictPath);
+    }
+    else if (command == "--prefix" && (argc == 3 || argc == 4))
+    {
+        std::string scanDictPath = (argc == 4) ? args[3] : dictPath;
+        ScanDictionary(scanDictPath, args[2], std::nullopt, true, scanLimit == 0 ? UINT64_MAX : scanLimit);
+    }
+    else if (command == "--range" && (argc == 4 || argc == 5))
+    {
+        std::string scanDictPath = (argc == 5) ? args[4] : dictPath;
+        ScanDictionary(scanDictPath, args[2], args[3], false, scanLimit == 0 ? UINT64_MAX : scanLimit);
+    }
+    else if (command == "--search-batch" && (argc == 3 || argc == 4))
+    {
+        std::string searchDictPath = (argc == 4) ? args[3] : dictPath;
+        SearchBatch(args[2], searchDictPath);
+    }
+    else if (command == "--put" && (argc == 4 || argc == 5))
+    {
+        std::string targetDictPath = (argc == 5) ? args[4] : dictPath;
+        PutWord(args[2], args[3], targetDictPath, syncOptions);
+    }
+    else if (command == "--delete" && (argc == 3 || argc == 4))
+    {
+        std::string targetDictPath = (argc == 4) ? args[3] : dictPath;
+        DeleteWord(args[2], targetDictPath, syncOptions);
+    }
+    else if (command == "--apply-csv" && (argc == 3 || argc == 4))
+    {
+        std::string targetDictPath = (argc == 4) ? args[3] : dictPath;
+        ApplyCSV(args[2], targetDictPath, syncOptions);
+    }
+    else if (command == "--compact" && (argc == 2 || argc == 3 || argc == 4))
+    {
+        std::string baseDictPath = (argc >= 3) ? args[2] : dictPath;
+        std::string outputPath = (argc == 4) ? args[3] : std::string();
+        if (!CompactDictionary(baseDictPath, outputPath, threads))
+            status = 1;
     }
     else if (command == "--merge-csv" && argc == 5)
     {
-        MergeCSV(argv[2], argv[3], argv[4]);
+        MergeCSV(args[2], args[3], args[4]);
     }
-    else if (command == "--merge-dict" && argc == 5)
+    else if (command == "--merge-dict" && argc >= 5)
     {
-        MergeDictionary(argv[2], argv[3], argv[4]);
+        // Every argument but the last is an input, in increasing precedence
+        if (!MergeDictionary(std::vector<std::string>(args.begin() + 2, args.end() - 1), args.back(), threads))
+            status = 1;
     }
     else if (command == "--read-dict" && (argc == 2 || argc == 3))
     {
-        std::string readDictPath = (argc == 3) ? argv[2] : dictPath;
-        ReadDictionary(readDictPath);
+        std::string readDictPath = (argc == 3) ? args[2] : dictPath;
+        ReadDictionary(readDictPath, threads);
+    }
+    else if (command == "--export-csv" && (argc == 3 || argc == 4))
+    {
+        std::string exportDictPath = (argc == 4) ? args[3] : dictPath;
+        if (!ExportCsv(exportDictPath, args[2], threads))
+            status = 1;
+    }
+    else if (command == "--verify-dict" && (argc == 2 || argc == 3))
+    {
+        std::string verifyDictPath = (argc == 3) ? args[2] : dictPath;
+        if (!VerifyDictionary(verifyDictPath, threads))
+            status = 1;
+    }
+    else if (command == "--serve" && (argc == 2 || argc == 3))
+    {
+        std::string serveDictPath = (argc == 3) ? args[2] : dictPath;
+        // Without an explicit path the server follows the config to each new version
+        ServeDictionary(serveDictPath, socketPath, threads, argc == 2);
     }
     else
     {
@@ -756,5 +6393,12 @@ int main(int argc, char *argv[])
         return 1;
     }
 
-    return 0;
+    if (statsEnabled)
+    {
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        std::clog.flush();
+        metrics.WriteJson(std::cerr, command, elapsed.count());
+    }
+    return status;
 }
+#endif // BITCASK_NO_MAIN
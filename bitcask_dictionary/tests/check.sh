@@ -0,0 +1,169 @@
+#!/bin/bash
+# Round-trip checks for bitcask_dictionary. Builds words.csv in every layout the build options
+# produce and reads it back next to the fixtures in legacy/, which older releases wrote from the
+# same CSV, so every format and layout must answer exactly like the oldest one.
+#
+# Usage: tests/check.sh [path/to/bitcask_dictionary]
+
+set -u
+
+here=$(cd "$(dirname "$0")" && pwd)
+binary=$(realpath "${1:-$here/../bitcask_dictionary}")
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+cd "$work" || exit 1
+
+# Every layout --create-dict, --merge-dict and --compact can write
+layouts=("" "--compress" "--shards 4" "--shards 4 --compress" "--perfect-hash" "--perfect-hash --shards 4 --compress")
+
+passed=0
+failed=0
+
+pass()
+{
+    passed=$((passed + 1))
+}
+
+fail()
+{
+    failed=$((failed + 1))
+    echo "FAIL: $*"
+}
+
+# The program's stdout; progress messages go to stderr and are dropped
+run()
+{
+    "$binary" "$@" 2>/dev/null
+}
+
+# expect_output <name> <expected file> <command...>
+expect_output()
+{
+    local name=$1 expected=$2
+    shift 2
+    if run "$@" | cmp -s "$expected" -; then
+        pass
+    else
+        fail "$name: output differs from $expected"
+        run "$@" | diff "$expected" - | head -5
+    fi
+}
+
+# expect_status <name> <status> <command...>
+expect_status()
+{
+    local name=$1 expected=$2
+    shift 2
+    run "$@" >/dev/null
+    local status=$?
+    if [ "$status" -eq "$expected" ]; then
+        pass
+    else
+        fail "$name: exited with $status, expected $expected"
+    fi
+}
+
+# What --prefix "" lists for CSVs applied in order, the last row of a word winning
+listing()
+{
+    awk '{ i = index($0, ","); if (i > 1) meaning[substr($0, 1, i - 1)] = substr($0, i + 1) }
+         END { for (word in meaning) print word ": " meaning[word] }' "$@" | LC_ALL=C sort
+}
+
+expect_listing()
+{
+    local name=$1 dict=$2
+    shift 2
+    listing "$@" >expected.txt
+    expect_output "$name" expected.txt --prefix "" "$dict"
+}
+
+cp "$here"/../words.csv "$here"/../changelog.csv .
+cp "$here"/legacy/*.bitcask .
+dicts=()
+for legacy in words_v*.bitcask; do
+    dicts+=("$legacy")
+done
+
+# Build every layout
+for i in "${!layouts[@]}"; do
+    # shellcheck disable=SC2086
+    expect_status "create ${layouts[$i]}" 0 --create-dict words.csv "layout$i.bitcask" ${layouts[$i]}
+    dicts+=("layout$i.bitcask")
+done
+
+# Answers from the oldest format are the reference for every other one
+awk -F, '{ print $1 }' words.csv >queries.txt
+printf 'aardvark\nbananas\nzzz\n' >>queries.txt
+reference=words_v1.bitcask
+run --search-batch queries.txt "$reference" >reference_batch.txt
+run --prefix ba "$reference" >reference_prefix.txt
+run --range cat house "$reference" >reference_range.txt
+for word in apple banana zebra nothing; do
+    run --search "$word" "$reference"
+done >reference_search.txt
+expect_listing "listing $reference" "$reference" words.csv
+
+for dict in "${dicts[@]}"; do
+    expect_status "verify $dict" 0 --verify-dict "$dict"
+    expect_listing "listing $dict" "$dict" words.csv
+    listing words.csv | sed 's/: /,/' | LC_ALL=C sort >expected.txt
+    run --export-csv - "$dict" | LC_ALL=C sort | cmp -s expected.txt - && pass || fail "export $dict" # Rows come in record order
+    expect_output "search-batch $dict" reference_batch.txt --search-batch queries.txt "$dict"
+    expect_output "prefix $dict" reference_prefix.txt --prefix ba "$dict"
+    expect_output "range $dict" reference_range.txt --range cat house "$dict"
+    for mode in "" --mmap --fast-read; do
+        for word in apple banana zebra nothing; do
+            run $mode --search "$word" "$dict"
+        done | cmp -s reference_search.txt - && pass || fail "search $mode $dict"
+    done
+done
+
+# Merge every sorted format and layout with a changelog into every layout, then compact each
+# merge. The oldest format's index may be unsorted, which --merge-dict warns about and --compact
+# refuses, so it is left out.
+run --create-dict changelog.csv changes.bitcask >/dev/null
+echo "kiwi,A small fuzzy fruit" >put.csv
+for dict in "${dicts[@]}"; do
+    [ "$dict" = "$reference" ] && continue
+    for i in "${!layouts[@]}"; do
+        merged="merged_${dict%.bitcask}_$i.bitcask"
+        # shellcheck disable=SC2086
+        expect_status "merge $dict ${layouts[$i]}" 0 --merge-dict "$dict" changes.bitcask "$merged" ${layouts[$i]}
+        expect_status "verify $merged" 0 --verify-dict "$merged"
+        expect_listing "listing $merged" "$merged" words.csv changelog.csv
+
+        run --put kiwi "A small fuzzy fruit" "$merged" >/dev/null
+        run --delete apple "$merged" >/dev/null
+        expect_status "compact $merged" 0 --compact "$merged" "compacted_$merged"
+        expect_status "verify compacted_$merged" 0 --verify-dict "compacted_$merged"
+        listing words.csv changelog.csv put.csv | grep -v '^apple: ' >expected.txt
+        expect_output "listing compacted_$merged" expected.txt --prefix "" "compacted_$merged"
+    done
+done
+
+# A legacy index may be unsorted, so compacting one is refused
+expect_status "compact $reference" 1 --compact "$reference" refused.bitcask
+
+# Failures exit with status 1 and leave the inputs alone
+expect_status "create from a missing CSV" 1 --create-dict missing.csv missing.bitcask
+expect_status "create in a missing directory" 1 --create-dict words.csv missing/words.bitcask
+expect_status "merge over an input" 1 --merge-dict layout0.bitcask changes.bitcask changes.bitcask
+expect_status "compact over the input" 1 --compact layout0.bitcask layout0.bitcask
+expect_listing "listing changes.bitcask after the refused merge" changes.bitcask changelog.csv
+
+# Concurrent puts all land in the active segment
+for n in $(seq 1 50); do
+    run --put "word$n" "meaning $n" layout0.bitcask >/dev/null &
+done
+wait
+found=$(for n in $(seq 1 50); do echo "word$n"; done >puts.txt && run --search-batch puts.txt layout0.bitcask | grep -c '^word')
+[ "$found" -eq 50 ] && pass || fail "concurrent puts: $found of 50 found"
+
+# Server replies stay one line per query, whatever the meaning holds
+run --put multiline $'first\nsecond' layout0.bitcask >/dev/null
+printf 'multiline\nnothing\n' | run --serve layout0.bitcask --socket - >served.txt
+printf 'OK first\\nsecond\nNOT_FOUND\n' | cmp -s - served.txt && pass || fail "serve escapes line breaks"
+
+echo "$passed passed, $failed failed"
+[ "$failed" -eq 0 ]